@@ -2,12 +2,20 @@
 
 // Interpolated values from the vertex shaders
 in vec3 fragColor;
+#ifdef SDF_CIRCLE
+in vec2 circleCoord;
+#endif
 
 // output data
 out vec3 color;
 
 void main()
 {
+#ifdef SDF_CIRCLE
+    // Distance from the center in radii, everything outside the unit circle is cut away
+    if(dot(circleCoord, circleCoord) > 1.0)
+        discard;
+#endif
     // Output color = color specified in the vertex shader,
     // interpolated between all 3 surrounding vertices of the triangle
     color = fragColor;
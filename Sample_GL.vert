@@ -1,21 +1,50 @@
 #version 330 core
 
+// Variants are compiled from this one source, LoadShaders injects their #defines:
+// INSTANCED       one mesh drawn many times, placed and scaled by a per-instance attribute
+// CONSTANT_COLOR  the whole batch has a single color uniform, no color attribute
+// SDF_CIRCLE      a unit quad turned into a circle in the fragment shader
+
 // input data : sent from main program
 layout (location = 0) in vec3 vertexPosition;
+#ifndef CONSTANT_COLOR
 layout (location = 1) in vec3 vertexColor;
+#endif
+#ifdef INSTANCED
+layout (location = 2) in vec3 instance; // x, y, scale
+#endif
 
 uniform mat4 MVP;
+#ifdef CONSTANT_COLOR
+uniform vec3 objectColor;
+#endif
+#ifdef SDF_CIRCLE
+uniform vec3 circle; // center x, y, radius
+out vec2 circleCoord;
+#endif
 
 // output data : used by fragment shader
 out vec3 fragColor;
 
 void main ()
 {
-    vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+    vec3 position = vertexPosition;
+#ifdef INSTANCED
+    position.xy = position.xy * instance.z + instance.xy;
+#endif
+#ifdef SDF_CIRCLE
+    circleCoord = position.xy;
+    position.xy = circle.xy + position.xy * circle.z;
+#endif
+    vec4 v = vec4(position, 1); // Transform an homogeneous 4D vector
 
     // The color of each vertex will be interpolated
     // to produce the color of each fragment
+#ifdef CONSTANT_COLOR
+    fragColor = objectColor;
+#else
     fragColor = vertexColor;
+#endif
 
     // Output position of the vertex, in clip space : MVP * position
     gl_Position = MVP * v;
@@ -1,6 +1,10 @@
 #include "header.h"
 #include "constant.h"
+#include "level.h"
+#include "env.h"
+#include "serve.h"
 #include "globals.h"
+#include "assets.h"
 
 using namespace std;
 
@@ -9,33 +13,153 @@ void keyboardChar (GLFWwindow* window, unsigned int key);
 void mouseButton (GLFWwindow* window, int button, int action, int mods);
 void reshapeWindow (GLFWwindow* window, int width, int height);
 void physics_engine();
+void createPowerPanel(float momentum);
+void finishRecording();
+void updateProjection();
+void stopSimulation();
+void stopGeometryBuild();
+void initLevel();
+
+/* Records how long a startup phase took and returns the start of the next one */
+std::chrono::steady_clock::time_point recordStartupPhase(const char *name, std::chrono::steady_clock::time_point start)
+{
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  StartupPhase phase = {name, std::chrono::duration<double, std::milli>(now - start).count()};
+  startupPhases.push_back(phase);
+  return now;
+}
+
+/* Shaders and the font are compiled in by tools/embed, nothing is read from disk at startup */
+const EmbeddedAsset *findAsset(const char *name)
+{
+  for (size_t i = 0; i < sizeof(embeddedAssets) / sizeof(embeddedAssets[0]); i++)
+    if(!strcmp(embeddedAssets[i].name, name))
+      return &embeddedAssets[i];
+  return NULL;
+}
+
+/* Empty for a file the build did not embed, which then fails to compile like a missing file did */
+std::string assetText(const char *name)
+{
+  const EmbeddedAsset *asset = findAsset(name);
+  return asset ? std::string((const char *)asset->data, asset->size) : std::string();
+}
+
+/* FNV-1a 64 of the shader sources and the driver, a driver update must never reuse an old binary */
+std::string programCacheKey(const std::string &vertexCode, const std::string &fragmentCode)
+{
+  const GLubyte *renderer = glGetString(GL_RENDERER);
+  const GLubyte *version = glGetString(GL_VERSION);
+  std::string parts[] = {vertexCode, fragmentCode, renderer ? (const char *)renderer : "", version ? (const char *)version : ""};
+  uint64_t hash = 14695981039346656037ull;
+  for (int p = 0; p < 4; p++)
+  {
+    // The terminating zero keeps "ab"+"c" and "a"+"bc" apart
+    for (size_t i = 0; i <= parts[p].size(); i++)
+    {
+      hash ^= (unsigned char)parts[p].c_str()[i];
+      hash *= 1099511628211ull;
+    }
+  }
+  char path[64];
+  snprintf(path, sizeof(path), "%s/%016llx.bin", SHADER_CACHE_DIR, (unsigned long long)hash);
+  return path;
+}
+
+bool programBinarySupported()
+{
+  if(!GLAD_GL_VERSION_4_1 && !GLAD_GL_ARB_get_program_binary)
+    return false;
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  return formats > 0;
+}
+
+/* Returns 0 on a miss or when the driver rejects the cached binary */
+GLuint loadCachedProgram(const std::string &path)
+{
+  std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+  if(!file.is_open())
+    return 0;
+  uint32_t format;
+  std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  if(binary.size() <= 4 + sizeof(format) || memcmp(&binary[0], PROGRAM_CACHE_MAGIC, 4) != 0)
+    return 0;
+  memcpy(&format, &binary[4], sizeof(format));
+  GLuint ProgramID = glCreateProgram();
+  glProgramBinary(ProgramID, format, &binary[8], binary.size() - 8);
+  GLint Result = GL_FALSE;
+  glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+  if(Result != GL_TRUE)
+  {
+    glDeleteProgram(ProgramID);
+    return 0;
+  }
+  return ProgramID;
+}
+
+void saveCachedProgram(GLuint ProgramID, const std::string &path)
+{
+  GLint length = 0;
+  glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+  if(length <= 0)
+    return;
+  std::vector<char> binary(8 + length);
+  GLenum format = 0;
+  glGetProgramBinary(ProgramID, length, NULL, &format, &binary[8]);
+  uint32_t storedFormat = format;
+  memcpy(&binary[0], PROGRAM_CACHE_MAGIC, 4);
+  memcpy(&binary[4], &storedFormat, sizeof(storedFormat));
+  // Write aside and rename, a crash never leaves a truncated binary behind
+  mkdir(SHADER_CACHE_DIR, 0755);
+  std::string temp = path + ".tmp";
+  FILE *file = fopen(temp.c_str(), "wb");
+  if(!file)
+    return;
+  bool written = fwrite(&binary[0], 1, binary.size(), file) == binary.size();
+  if(fclose(file) == 0 && written)
+    rename(temp.c_str(), path.c_str());
+  else
+    remove(temp.c_str());
+}
+
+/* Variants share one source, their #defines go right after the #version line */
+std::string injectDefines(const std::string &code, const char *defines)
+{
+  size_t version = code.find("#version");
+  size_t line = version == std::string::npos ? 0 : code.find('\n', version);
+  if(line == std::string::npos)
+    line = code.size();
+  return code.substr(0, line) + "\n" + defines + code.substr(line);
+}
 
 /* Function to load Shaders - Use it as it is */
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const char *defines = "") {
 
 	// Create the shaders
 	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
 	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open())
-	{
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
-	}
+	// The shader code is part of the executable
+	std::string VertexShaderCode = assetText(vertex_file_path);
+	std::string FragmentShaderCode = assetText(fragment_file_path);
+
+	VertexShaderCode = injectDefines(VertexShaderCode, defines);
+	FragmentShaderCode = injectDefines(FragmentShaderCode, defines);
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
+	// Reuse the driver's compiled program from an earlier launch when we can
+	bool cacheable = programBinarySupported();
+	std::string cachePath = programCacheKey(VertexShaderCode, FragmentShaderCode);
+	if(cacheable)
+	{
+		GLuint CachedID = loadCachedProgram(cachePath);
+		if(CachedID)
+		{
+			printf("Loaded cached program : %s %s\n", vertex_file_path, fragment_file_path);
+			glDeleteShader(VertexShaderID);
+			glDeleteShader(FragmentShaderID);
+			return CachedID;
+		}
 	}
 
 	GLint Result = GL_FALSE;
@@ -72,6 +196,8 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	if(cacheable)
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -81,6 +207,9 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 	fprintf(stdout, "%s\n", &ProgramErrorMessage[0]);
 
+	if(cacheable && Result == GL_TRUE)
+		saveCachedProgram(ProgramID, cachePath);
+
 	glDeleteShader(VertexShaderID);
 	glDeleteShader(FragmentShaderID);
 
@@ -92,6 +221,67 @@ static void error_callback(int error, const char* description)
     fprintf(stderr, "Error: %s\n", description);
 }
 
+/* splitmix64's finalizer, spreads any 64 bit value over all 64 bits */
+uint64_t mixBits(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+/* Zobrist term of one feature value, derived on the fly so huge levels need no tables */
+uint64_t zobrist(uint32_t kind, uint32_t index, uint32_t value)
+{
+  return mixBits(mixBits((uint64_t)kind << 32 | index) ^ value);
+}
+
+/* XOR a term out before a feature changes and in again after, worldKey then follows the world */
+void zobristToggle(uint32_t kind, uint32_t index, uint32_t value)
+{
+  worldKey ^= zobrist(kind, index, value);
+}
+
+uint32_t floatBits(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+uint32_t cellFeature(int cell)
+{
+  return (uint32_t)grid[cell].replacing << 1 | grid[cell].toReplace;
+}
+
+void zobristCell(int cell)
+{
+  zobristToggle(ZOBRIST_CELL, cell, cellFeature(cell));
+}
+
+/* The same key built from scratch, for a freshly loaded level */
+uint64_t computeWorldKey()
+{
+  uint64_t key = 0;
+  for (int i = 0; i < numOfIce; i++)
+    key ^= zobrist(ZOBRIST_ICE, i, iceBroken[i]) ^ zobrist(ZOBRIST_ICE_FALL, i, floatBits(iceTranslate[i])) ^ zobrist(ZOBRIST_CELL, iceCell[i], cellFeature(iceCell[i]));
+  for (int i = 0; i < numOfPiggy; i++)
+    key ^= zobrist(ZOBRIST_PIGGY, i, piggyHurt[i]) ^ zobrist(ZOBRIST_PIGGY_FALL, i, floatBits(piggyTranslate[i])) ^ zobrist(ZOBRIST_CELL, piggyCell[i], cellFeature(piggyCell[i]));
+  return key;
+}
+
+/* Built once per level, a level with the same counts and state but other positions or birds gets another key */
+uint64_t computeLevelKey()
+{
+  uint64_t key = mixBits((uint64_t)numOfIce << 32 | (uint32_t)numOfPiggy) ^ numOfBirds;
+  for (int i = 0; i < numOfIce; i++)
+    key = mixBits(key ^ ((uint64_t)floatBits(iceX[i]) << 32 | floatBits(iceY[i])));
+  for (int i = 0; i < numOfPiggy; i++)
+    key = mixBits(key ^ ((uint64_t)floatBits(piggyX[i]) << 32 | floatBits(piggyY[i])));
+  for (int i = 0; i < numOfBirds; i++)
+    key = mixBits(key ^ ((uint64_t)birdType[i] << 32 | floatBits(birdSize[i])));
+  return key;
+}
+
 void stamp(float xFactor, float yFactor)
 {
   phy_time = 0;
@@ -101,16 +291,24 @@ void stamp(float xFactor, float yFactor)
   bird_storeY[phy_index] = birdDisplaceY[phy_index];
 }
 
-void makeFall(int x, int y)
+/* Occupied cell at a column and row, -1 when it is empty */
+int findCell(int col, int row)
+{
+  return levelFindCell(grid, cellSlots, slotCapacity, col, row);
+}
+
+void makeFall(int cell)
 {
-  float loop = (float)all[x][y].replacing;
-  int index = all[x][y].index;
-  float translate = TIME_REFERENCE * EARTH_GRAVITY;
-  if(all[x][y].isPiggy)
+  float loop = (float)grid[cell].replacing;
+  int index = grid[cell].index;
+  float translate = physics.timeReference * physics.gravity;
+  if(grid[cell].isPiggy)
   {
     if(piggyTranslate[index] + translate <= loop*OBSTACLE_ICE_SIZE)
     {
+      zobristToggle(ZOBRIST_PIGGY_FALL, index, floatBits(piggyTranslate[index]));
       piggyTranslate[index] += translate;
+      zobristToggle(ZOBRIST_PIGGY_FALL, index, floatBits(piggyTranslate[index]));
       piggyY[index] -= translate;
     }
   }
@@ -118,54 +316,110 @@ void makeFall(int x, int y)
   {
     if(iceTranslate[index] + translate <= loop*OBSTACLE_ICE_SIZE)
     {
+      zobristToggle(ZOBRIST_ICE_FALL, index, floatBits(iceTranslate[index]));
       iceTranslate[index] += translate;
+      zobristToggle(ZOBRIST_ICE_FALL, index, floatBits(iceTranslate[index]));
       iceY[index] -= translate;
     }
   }
 }
 
+/* Vacated cells pass up each column, only occupied cells are visited */
 void checkFall()
 {
-  int num = sqrt(numOfPiggy + numOfIce);
-  for (int i = 0; i < num; i++)
+  for (int c = 0; c < numColumns; c++)
   {
-    for (int j = num - 1; j > 0; j--)
+    for (int j = columnTops[c]; j >= 0; j = grid[j].below)
     {
-      int temp = 0;
-      for (int k = j - 1; k >= 0; k--)
+      for (int k = grid[j].below; k >= 0; k = grid[k].below)
       {
-        if(all[i][k].toReplace)
+        if(grid[k].toReplace)
         {
-          all[i][k].toReplace = false;
-          all[i][j].toReplace = true;
-          all[i][j].replacing ++;
+          zobristCell(k);
+          zobristCell(j);
+          grid[k].toReplace = false;
+          grid[j].toReplace = true;
+          grid[j].replacing ++;
+          zobristCell(k);
+          zobristCell(j);
         }
         else
           break;
       }
-      makeFall(i, j);
+      makeFall(j);
     }
   }
 }
 
 void setObstacleDead(int index, bool isPiggy)
 {
-  int num = sqrt(numOfPiggy + numOfIce);
-  for (int i = 0; i < num; i++)
+  int cell = isPiggy ? piggyCell[index] : iceCell[index];
+  zobristCell(cell);
+  grid[cell].toReplace  = true;
+  grid[cell].replacing = 0;
+  zobristCell(cell);
+}
+
+/* Deterministic mode trig: Cephes single precision polynomials evaluated as a fixed sequence of float */
+/* operations. Built with -ffp-contract=off and SSE math, every IEEE machine gets the same bits, libm does not */
+float detSinCos(float x, bool wantCos)
+{
+  // Cody-Waite reduction by pi/2, the constant split so k * high is exact
+  float k = floorf(x * 0.63661977236758134f + 0.5f);
+  float r = (x - k * 1.5707963705062866f) - k * -4.37113900018624283e-8f;
+  float z = r * r;
+  float sine = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) * z * r + r;
+  float cosine = ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z * z - 0.5f * z + 1.0f;
+  switch(((int)k + (wantCos ? 1 : 0)) & 3)
   {
-    for (int j = 0; j < num; j++)
-    {
-      if(all[i][j].index == index && (!(all[i][j].isPiggy ^ isPiggy)))
-      {
-        all[i][j].toReplace  = true;
-        all[i][j].replacing = 0;
-      }
-    }
+    case 0: return sine;
+    case 1: return cosine;
+    case 2: return -sine;
+    default: return -cosine;
   }
 }
 
+/* Arcsine for |x| <= 0.5 */
+float detAsin(float x)
+{
+  float z = x * x;
+  return ((((4.2163199048e-2f * z + 2.4181311049e-2f) * z + 4.5470025998e-2f) * z + 7.4953002686e-2f) * z + 1.6666752422e-1f) * z * x + x;
+}
+
+float detAcos(float x)
+{
+  if(x > 0.5f)
+    return 2.0f * detAsin(sqrtf(0.5f * (1.0f - min(x, 1.0f))));
+  if(x < -0.5f)
+    return 3.14159265358979f - 2.0f * detAsin(sqrtf(0.5f * (1.0f + max(x, -1.0f))));
+  return 1.57079632679490f - detAsin(x);
+}
+
+/* Trig of the simulation, libm unless the deterministic mode is on */
+float simSin(float x)
+{
+  return deterministicPhysics ? detSinCos(x, false) : sinf(x);
+}
+
+float simCos(float x)
+{
+  return deterministicPhysics ? detSinCos(x, true) : cosf(x);
+}
+
+/* a*b-c where the product rounds away a bit that a fused multiply-add would keep */
+bool floatContractionFree()
+{
+  volatile float a = 1.0f + 1.0f / (1 << 23), c = 1.0f + 1.0f / (1 << 22);
+  return a * a - c == 0.0f;
+}
+
 bool collisionDetect(float x, float y, float radius)
 {
+  if(deterministicPhysics)
+  {
+    float dx = x - phy_x[phy_index], dy = y - phy_y[phy_index];
+    return sqrtf(dx * dx + dy * dy) <= radius + birdSize[phy_index];
+  }
   float bird[] = {phy_x[phy_index], phy_y[phy_index], 0.0f};
   float obs[] = {x, y, 0.0f};
   glm::vec3 a = glm::make_vec3(bird);
@@ -179,6 +433,11 @@ bool collisionDetect(float x, float y, float radius)
 
 float collisionAngle(float x, float y)
 {
+  if(deterministicPhysics)
+  {
+    float dx = x - birdDisplaceX[phy_index], dy = y - birdDisplaceY[phy_index];
+    return detAcos(dx / sqrtf(dx * dx + dy * dy));
+  }
   glm::vec3 obs = glm::vec3(x, y, 0);
   glm::vec3 bird = glm::vec3(birdDisplaceX[phy_index], birdDisplaceY[phy_index], 0.0f);
   glm::vec3 diff = glm::normalize(obs - bird);
@@ -191,11 +450,10 @@ bool collisionIntense(float x, float y, int status)
 {
   if(status > 0)
     return true;
-  cout << "Hello" << endl;
   float angle = collisionAngle(x, y);
   if(angle < M_PI/4)
   {
-    if(phy_ux * cos(angle) >= BREAK_MIN)
+    if(phy_ux * simCos(angle) >= physics.breakMin)
     {
       stamp(0.8, 1);
       return true;
@@ -219,12 +477,18 @@ void collisionEngine()
           if(piggyHurt[i]!=2)
           {
             setObstacleDead(i, true);
+            zobristToggle(ZOBRIST_PIGGY, i, piggyHurt[i]);
             piggyHurt[i] = 2;
+            zobristToggle(ZOBRIST_PIGGY, i, piggyHurt[i]);
             score += 10;
           }
         }
         else
+        {
+          zobristToggle(ZOBRIST_PIGGY, i, piggyHurt[i]);
           piggyHurt[i] = 1;
+          zobristToggle(ZOBRIST_PIGGY, i, piggyHurt[i]);
+        }
         colPiggy[i] = false;
       }
     }
@@ -240,12 +504,18 @@ void collisionEngine()
           if(iceBroken[i]!=2)
           {
             setObstacleDead(i, false);
+            zobristToggle(ZOBRIST_ICE, i, iceBroken[i]);
             iceBroken[i] = 2;
+            zobristToggle(ZOBRIST_ICE, i, iceBroken[i]);
             score += 5;
           }
         } 
         else
+        {
+          zobristToggle(ZOBRIST_ICE, i, iceBroken[i]);
           iceBroken[i] = 1;
+          zobristToggle(ZOBRIST_ICE, i, iceBroken[i]);
+        }
         colIce[i] = false;
       }
     }
@@ -257,12 +527,12 @@ void physics_engine()
   if(phy_start)
   {
     float temp = (float)GROUND_HEIGHT + birdSize[phy_index];
-    phy_x[phy_index] = 60.0f + (CANON_TUNNEL_LENGTH * cos(phy_angle)) + birdDisplaceX[phy_index] + temp;
-    phy_y[phy_index] = 20.0f + (CANON_TUNNEL_LENGTH * sin(phy_angle)) + birdDisplaceY[phy_index] + temp;
-    phy_time += 0.1;
+    phy_x[phy_index] = 60.0f + (CANON_TUNNEL_LENGTH * simCos(phy_angle)) + birdDisplaceX[phy_index] + temp;
+    phy_y[phy_index] = 20.0f + (CANON_TUNNEL_LENGTH * simSin(phy_angle)) + birdDisplaceY[phy_index] + temp;
+    phy_time += physics.timeReference;
     birdDisplaceX[phy_index] = bird_storeX[phy_index] + phy_ux * phy_time;
-    phy_vy = phy_uy - (EARTH_GRAVITY*phy_time);
-    birdDisplaceY[phy_index] = bird_storeY[phy_index] + (phy_uy * phy_time) - ((EARTH_GRAVITY * phy_time * phy_time)/2);
+    phy_vy = phy_uy - (physics.gravity*phy_time);
+    birdDisplaceY[phy_index] = bird_storeY[phy_index] + (phy_uy * phy_time) - ((physics.gravity * phy_time * phy_time)/2);
     collisionEngine();
   }
   else
@@ -271,6 +541,11 @@ void physics_engine()
 
 void quit(GLFWwindow *window)
 {
+    stopSimulation();
+    stopGeometryBuild();
+    finishRecording();
+    if(headless)
+      exit(EXIT_SUCCESS);
     glfwDestroyWindow(window);
     glfwTerminate();
     exit(EXIT_SUCCESS);
@@ -280,10 +555,15 @@ void quit(GLFWwindow *window)
 /* Generate VAO, VBOs and return VAO handle */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
 {
+    // Headless runs never create a GL context, only the simulation state is built
+    if(headless)
+      return NULL;
+
     struct VAO* vao = new struct VAO;
     vao->PrimitiveMode = primitive_mode;
     vao->NumVertices = numVertices;
     vao->FillMode = fill_mode;
+    vao->InstanceBuffer = 0;
 
     // Create Vertex Array Object
     // Should be done after CreateWindow and before any other GL calls
@@ -292,6 +572,7 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
     glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
 
     glBindVertexArray (vao->VertexArrayID); // Bind the VAO 
+    glBufferBytes += 2*3*numVertices*sizeof(GLfloat);
     glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices 
     glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
     glVertexAttribPointer(
@@ -330,9 +611,25 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
     return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
 }
 
+/* Release the VAO and its VBOs, used for objects that get rebuilt */
+void destroy3DObject (struct VAO* vao)
+{
+    if(vao == NULL)
+      return;
+    glDeleteBuffers(1, &(vao->VertexBuffer));
+    glDeleteBuffers(1, &(vao->ColorBuffer));
+    if(vao->InstanceBuffer)
+      glDeleteBuffers(1, &(vao->InstanceBuffer));
+    glDeleteVertexArrays(1, &(vao->VertexArrayID));
+    delete vao;
+}
+
 /* Render the VBOs handled by VAO */
 void draw3DObject (struct VAO* vao)
 {
+    if(vao == NULL)
+      return;
+
     // Change the Fill Mode for this object
     glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
 
@@ -350,6 +647,7 @@ void draw3DObject (struct VAO* vao)
     glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
 
     // Draw the geometry !
+    drawCalls++;
     glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
 }
 
@@ -357,46 +655,60 @@ void draw3DObject (struct VAO* vao)
  * Customizable functions *
  **************************/
 
+Bounds makeBounds(float minX, float minY, float maxX, float maxY)
+{
+  Bounds bounds;
+  bounds.minX = minX;
+  bounds.minY = minY;
+  bounds.maxX = maxX;
+  bounds.maxY = maxY;
+  return bounds;
+}
 
-VAO* drawCircle(GLfloat x, GLfloat y, GLfloat z, GLfloat radius, GLint numberOfSides, GLfloat red, GLfloat blue, GLfloat green)
+int chunkOf(float x)
 {
-  GLint numberOfVertices = numberOfSides + 2;
+  return max(0, (int)floor(x / CHUNK_WIDTH));
+}
 
-  GLfloat doublePI = 2.0f * M_PI;
-  
-  GLfloat circleVerticesX[numberOfVertices];
-  GLfloat circleVerticesY[numberOfVertices];
-  GLfloat circleVerticesZ[numberOfVertices];
+/* Test an entity's creation time bounds, moved by its translation, against the projection bounds */
+bool inView(const Bounds &bounds, float dx, float dy)
+{
+  bool visible = bounds.maxX + dx >= viewBounds.minX && bounds.minX + dx <= viewBounds.maxX &&
+                 bounds.maxY + dy >= viewBounds.minY && bounds.minY + dy <= viewBounds.maxY;
+  if(visible)
+    entitiesDrawn++;
+  else
+    entitiesCulled++;
+  return visible;
+}
 
-  circleVerticesX[0] = x;
-  circleVerticesY[0] = y;
-  circleVerticesZ[0] = z;
 
-  for (int i = 1; i < numberOfVertices; i++)
-  {
-    circleVerticesX[i] = x + (radius * cos(i * doublePI/numberOfSides));
-    circleVerticesY[i] = y + (radius * sin(i * doublePI/numberOfSides));
-    circleVerticesZ[i] = z;
-  }
+/* Circle as a triangle fan, only CPU work so it can run on any thread */
+Mesh circleMesh(GLfloat x, GLfloat y, GLfloat z, GLfloat radius, GLint numberOfSides, GLfloat red, GLfloat blue, GLfloat green)
+{
+  GLint numberOfVertices = numberOfSides + 2;
 
-  GLfloat allVertices[numberOfVertices * 3];
-  GLfloat allColors[numberOfVertices * 3];
+  GLfloat doublePI = 2.0f * M_PI;
+
+  Mesh mesh;
+  mesh.primitiveMode = GL_TRIANGLE_FAN;
+  mesh.fillMode = GL_LINE;
+  mesh.vertices.resize(numberOfVertices * 3);
+  mesh.colors.resize(numberOfVertices * 3);
   for (int i = 0; i < numberOfVertices; i++)
   {
-    allVertices[i * 3] = circleVerticesX[i];
-    allColors[i * 3] = red;
-    allVertices[(i * 3) + 1] = circleVerticesY[i];
-    allColors[(i * 3) + 1] = blue;
-    allVertices[(i * 3) + 2] = circleVerticesZ[i];
-    allColors[(i * 3) + 2] = green;
+    mesh.vertices[i * 3] = i == 0 ? x : x + (radius * cos(i * doublePI/numberOfSides));
+    mesh.vertices[(i * 3) + 1] = i == 0 ? y : y + (radius * sin(i * doublePI/numberOfSides));
+    mesh.vertices[(i * 3) + 2] = z;
+    mesh.colors[i * 3] = red;
+    mesh.colors[(i * 3) + 1] = blue;
+    mesh.colors[(i * 3) + 2] = green;
   }
-
-  return create3DObject(GL_TRIANGLE_FAN, numberOfVertices, allVertices, allColors, GL_LINE);
+  return mesh;
 }
 
-VAO* drawRectangle(GLfloat x, GLfloat y, GLfloat z, GLfloat halfLength, GLfloat halfWidth, GLfloat red, GLfloat blue, GLfloat green, bool fill_mode) 
+Mesh rectangleMesh(GLfloat x, GLfloat y, GLfloat z, GLfloat halfLength, GLfloat halfWidth, GLfloat red, GLfloat blue, GLfloat green, bool fill_mode)
 {
-
     // GL3 accepts only Triangles. Quads are not supported
   GLfloat vertex_buffer_data [] = {
     x - halfWidth, y + halfLength, z, // vertex 1
@@ -408,24 +720,20 @@ VAO* drawRectangle(GLfloat x, GLfloat y, GLfloat z, GLfloat halfLength, GLfloat
     x - halfWidth, y + halfLength, z // vertex 1
   };
 
-  GLfloat color_buffer_data [] = {
-    red ,blue, green, // color 1
-    red ,blue, green, // color 2
-    red ,blue, green, // color 3
-
-    red ,blue, green, // color 3
-    red ,blue, green, // color 4
-    red ,blue, green  // color 1
-  };
-
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  if(fill_mode)
-    return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-  else
-    return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_LINE);
+  Mesh mesh;
+  mesh.primitiveMode = GL_TRIANGLES;
+  mesh.fillMode = fill_mode ? GL_FILL : GL_LINE;
+  mesh.vertices.assign(vertex_buffer_data, vertex_buffer_data + 18);
+  for (int i = 0; i < 6; i++)
+  {
+    mesh.colors.push_back(red);
+    mesh.colors.push_back(blue);
+    mesh.colors.push_back(green);
+  }
+  return mesh;
 }
 
-VAO* drawBeak(GLfloat x, GLfloat y, GLfloat z, GLfloat size)
+Mesh beakMesh(GLfloat x, GLfloat y, GLfloat z, GLfloat size)
 {
   GLfloat beakSize = size / 2;
   GLfloat vertex_buffer_data [] = {
@@ -438,12 +746,77 @@ VAO* drawBeak(GLfloat x, GLfloat y, GLfloat z, GLfloat size)
     1, 0.5, 0,
     1, 0.5, 0
   };
-  return create3DObject(GL_TRIANGLES, 3, vertex_buffer_data, color_buffer_data, GL_FILL);
+  Mesh mesh;
+  mesh.primitiveMode = GL_TRIANGLES;
+  mesh.fillMode = GL_FILL;
+  mesh.vertices.assign(vertex_buffer_data, vertex_buffer_data + 9);
+  mesh.colors.assign(color_buffer_data, color_buffer_data + 9);
+  return mesh;
+}
+
+/* The GL thread half, turns staged geometry into buffers */
+VAO* uploadMesh(const Mesh &mesh)
+{
+  return create3DObject(mesh.primitiveMode, mesh.vertices.size() / 3, &mesh.vertices[0], &mesh.colors[0], mesh.fillMode);
+}
+
+VAO* drawCircle(GLfloat x, GLfloat y, GLfloat z, GLfloat radius, GLint numberOfSides, GLfloat red, GLfloat blue, GLfloat green)
+{
+  return uploadMesh(circleMesh(x, y, z, radius, numberOfSides, red, blue, green));
+}
+
+VAO* drawRectangle(GLfloat x, GLfloat y, GLfloat z, GLfloat halfLength, GLfloat halfWidth, GLfloat red, GLfloat blue, GLfloat green, bool fill_mode) 
+{
+  return uploadMesh(rectangleMesh(x, y, z, halfLength, halfWidth, red, blue, green, fill_mode));
+}
+
+VAO* drawBeak(GLfloat x, GLfloat y, GLfloat z, GLfloat size)
+{
+  return uploadMesh(beakMesh(x, y, z, size));
+}
+
+/* One mesh drawn once per instance, every instance is an x, y and scale for the unit sized mesh */
+VAO* createInstanced3DObject(const Mesh &mesh)
+{
+  VAO *vao = uploadMesh(mesh);
+  if(vao == NULL)
+    return NULL;
+  glBindVertexArray(vao->VertexArrayID);
+  glGenBuffers(1, &(vao->InstanceBuffer));
+  glBindBuffer(GL_ARRAY_BUFFER, vao->InstanceBuffer);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+  glVertexAttribDivisor(2, 1);
+  return vao;
+}
+
+/* Streams this frame's instances and draws them all in one call, needs the INSTANCED variant bound */
+void drawInstanced3DObject(struct VAO* vao, const GLfloat *instances, int count)
+{
+  if(vao == NULL || count == 0)
+    return;
+  glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+  glBindVertexArray (vao->VertexArrayID);
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+  glEnableVertexAttribArray(2);
+  glBindBuffer(GL_ARRAY_BUFFER, vao->InstanceBuffer);
+  glBufferData(GL_ARRAY_BUFFER, 3 * count * sizeof(GLfloat), instances, GL_STREAM_DRAW);
+  drawCalls++;
+  glDrawArraysInstanced(vao->PrimitiveMode, 0, vao->NumVertices, count);
+}
+
+void stageMesh(std::vector<StagedMesh> &staged, uint32_t kind, uint32_t index, const Mesh &mesh)
+{
+  StagedMesh item;
+  item.kind = kind;
+  item.index = index;
+  item.mesh = mesh;
+  staged.push_back(item);
 }
 
 //Pupil and Sclera are the colored part in eye, I assume that bird has no  pupil
 
-void createBirdEye(GLfloat radius, GLfloat x, GLfloat y, GLfloat z, int order)
+void stageBirdEye(std::vector<StagedMesh> &staged, GLfloat radius, GLfloat x, GLfloat y, GLfloat z, int order)
 {
   GLfloat irisRadius = radius/3;
   GLfloat scleraRadius = irisRadius / 2;
@@ -451,37 +824,43 @@ void createBirdEye(GLfloat radius, GLfloat x, GLfloat y, GLfloat z, int order)
   GLfloat xIris = x + (radius - irisRadius) * cos(theAngle);
   GLfloat yIris = y + (radius - irisRadius) * sin(theAngle);
   GLfloat zIris = z;
-  birdEyeIris[order] = drawCircle(xIris, yIris, zIris, irisRadius, 360, 0, 0, 0) ;
+  stageMesh(staged, MESH_BIRD_EYE_IRIS, order, circleMesh(xIris, yIris, zIris, irisRadius, CIRCLE_SIDES, 0, 0, 0));
   GLfloat xSclera = xIris + (irisRadius - scleraRadius) * cos(theAngle);
   GLfloat ySclera = yIris + (irisRadius - scleraRadius) * sin(theAngle);
   GLfloat zSclera = zIris;
-  birdEyeSclera[order] = drawCircle(xSclera, ySclera, zSclera, scleraRadius, 360, 1, 1, 1);
+  stageMesh(staged, MESH_BIRD_EYE_SCLERA, order, circleMesh(xSclera, ySclera, zSclera, scleraRadius, CIRCLE_SIDES, 1, 1, 1));
 }
 
 
-void createBird(GLfloat size, GLfloat red, GLfloat blue, GLfloat green, int order, int type)
+void stageBird(std::vector<StagedMesh> &staged, GLfloat size, GLfloat red, GLfloat blue, GLfloat green, int order)
 {
   GLfloat radius = size;
   GLfloat x = (float)GROUND_HEIGHT + radius; //Illogical but just for sake :P
   GLfloat y = (float)GROUND_HEIGHT + radius;
   GLfloat z = 0;
-  GLint numberOfSides = 360;
-  birdFace[order] = drawCircle(x, y, z, radius, numberOfSides, red, blue, green);
-  birdBeak[order] = drawBeak(x, y, z, size);
-  createBirdEye(size, x, y, z, order);
+  GLint numberOfSides = CIRCLE_SIDES;
+  stageMesh(staged, MESH_BIRD_FACE, order, circleMesh(x, y, z, radius, numberOfSides, red, blue, green));
+  stageMesh(staged, MESH_BIRD_BEAK, order, beakMesh(x, y, z, size));
+  stageBirdEye(staged, size, x, y, z, order);
+}
+
+void createBird(GLfloat size, int order, int type)
+{
+  GLfloat radius = size;
+  GLfloat x = (float)GROUND_HEIGHT + radius;
+  GLfloat y = (float)GROUND_HEIGHT + radius;
   birdSize[order] = size;
+  birdBounds[order] = makeBounds(x - radius, y - radius, x + 2*size, y + radius);
   birdType[order] = type;
   numOfBirds++;
 }
 
-void createPowerPanel(int val)
+void createPowerPanel(float momentum)
 {
-  float temp = canonMomentum + val;
   float padding = 5.0f;
   float r = 1,g = 1, b =0;
-  if(temp >= CANON_MIN_MOM and temp <= CANON_MAX_MOM)
-    canonMomentum = temp;
-  float powerX = (canonMomentum - CANON_MIN_MOM) * (POWER_PANEL_HALF_LENGTH * 2)/ (CANON_MAX_MOM - CANON_MIN_MOM);
+  panelMomentum = momentum;
+  float powerX = (momentum - CANON_MIN_MOM) * (POWER_PANEL_HALF_LENGTH * 2)/ (CANON_MAX_MOM - CANON_MIN_MOM);
 
   if(powerX >= POWER_PANEL_HALF_LENGTH/2 and powerX < POWER_PANEL_HALF_LENGTH)
     r = 0, g = 1;
@@ -507,21 +886,26 @@ void createPowerPanel(int val)
     r,g,b, // color 4
     r,g,b  // color 1
   };
+  destroy3DObject(PowerPanelFill);
+  destroy3DObject(PowerPanelOut);
   PowerPanelFill = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
   PowerPanelOut = drawRectangle(CANON_WHEEL_CENTERX, GROUND_HEIGHT - POWER_PANEL_HALF_WIDTH - padding, 0.0f, POWER_PANEL_HALF_WIDTH, POWER_PANEL_HALF_LENGTH, 0.5, 0.3, 0.3, true);
 }
 
-void createGround()
+/* One CHUNK_WIDTH wide slice of ground, chunks are only kept for the part of the world near the view */
+VAO* createGroundChunk(int index)
 {
+  GLfloat left = index * CHUNK_WIDTH;
+  GLfloat right = left + CHUNK_WIDTH;
     // GL3 accepts only Triangles. Quads are not supported
   GLfloat vertex_buffer_data [] = {
-    0,0,0, // vertex 1
-    screen_width,0,0, // vertex 2
-    screen_width, GROUND_HEIGHT,0, // vertex 3
+    left,0,0, // vertex 1
+    right,0,0, // vertex 2
+    right, GROUND_HEIGHT,0, // vertex 3
 
-    screen_width, GROUND_HEIGHT,0, // vertex 3
-    0, GROUND_HEIGHT, 0, // vertex 4
-    0,0,0  // vertex 1
+    right, GROUND_HEIGHT,0, // vertex 3
+    left, GROUND_HEIGHT, 0, // vertex 4
+    left,0,0  // vertex 1
   };
 
   GLfloat color_buffer_data [] = {
@@ -534,10 +918,47 @@ void createGround()
     0.5, 0.18, 0.12  // color 1
   };
 
-  createPowerPanel(0);
-
   // create3DObject creates and returns a handle to a VAO that can be used later
-  ground = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL); 
+  return create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL); 
+}
+
+/* Bucket obstacles by the chunk their left edge is in, they only ever move vertically */
+void buildChunks()
+{
+  worldWidth = SCREEN_WIDTH;
+  for (int i = 0; i < numOfIce; i++)
+    worldWidth = max(worldWidth, iceBounds[i].maxX + OBSTACLE_ICE_SIZE);
+  for (int i = 0; i < numOfPiggy; i++)
+    worldWidth = max(worldWidth, piggyBounds[i].maxX + OBSTACLE_ICE_SIZE);
+  chunks.assign((size_t)ceil(worldWidth / CHUNK_WIDTH), Chunk());
+  for (int i = 0; i < numOfIce; i++)
+    chunks[chunkOf(iceBounds[i].minX)].ice.push_back(i);
+  for (int i = 0; i < numOfPiggy; i++)
+    chunks[chunkOf(piggyBounds[i].minX)].piggy.push_back(i);
+}
+
+/* Keep ground geometry only for the visible chunks and CHUNK_RESIDENT on either side */
+void updateResidentChunks(int firstChunk, int lastChunk)
+{
+  int first = max(0, firstChunk - CHUNK_RESIDENT);
+  int last = lastChunk + CHUNK_RESIDENT;
+  if((int)chunks.size() <= last)
+    chunks.resize(last + 1);
+  for (int c = residentFirst; c <= residentLast; c++)
+  {
+    if(c < first || c > last)
+    {
+      destroy3DObject(chunks[c].ground);
+      chunks[c].ground = NULL;
+    }
+  }
+  for (int c = first; c <= last; c++)
+  {
+    if(chunks[c].ground == NULL)
+      chunks[c].ground = createGroundChunk(c);
+  }
+  residentFirst = first;
+  residentLast = last;
 }
 
 void createCanon()
@@ -570,99 +991,2745 @@ void createCanon()
   canonTunnel = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
-void createPiggy(GLfloat xPiggy, GLfloat yPiggy)
+/* Geometry for a piggy of the level, it is drawn around its starting cell */
+void stagePiggy(std::vector<StagedMesh> &staged, int index, GLfloat startY)
 {
   float padding = 5.0f;
+  GLfloat xPiggy = piggyX[index];
+  GLfloat yPiggy = startY + padding;
   float theAngle = M_PI/6;
   float eyeIrisShiftX = ((3*(OBSTACLE_ICE_SIZE/8)) - padding) * cos(theAngle) - (padding/4);
   float eyeIrisShiftY = ((3*(OBSTACLE_ICE_SIZE/8)) - padding) * sin(theAngle);
-  piggyLeftEyeSclera[numOfPiggy]  = drawCircle(xPiggy - eyeIrisShiftX - (padding/4), yPiggy - ((1.4) * padding) + eyeIrisShiftY, 0, (OBSTACLE_ICE_SIZE/20) , 360, 0.0, 0.0, 0.0);
-  piggyRightEyeSclera[numOfPiggy]  = drawCircle(xPiggy + eyeIrisShiftX + (padding/4), yPiggy - ((1.4) * padding) + eyeIrisShiftY, 0, (OBSTACLE_ICE_SIZE/20) , 360, 0.0, 0.0, 0.0);
-  piggyLeftEyeIris[numOfPiggy]  = drawCircle(xPiggy - eyeIrisShiftX, yPiggy - ((1.5) * padding) + eyeIrisShiftY, 0, (OBSTACLE_ICE_SIZE/10) , 360, 1.0, 1.0, 1.0);
-  piggyRightEyeIris[numOfPiggy] = drawCircle(xPiggy + eyeIrisShiftX, yPiggy - ((1.5) * padding) + eyeIrisShiftY, 0, (OBSTACLE_ICE_SIZE/10) , 360, 1.0, 1.0, 1.0);
-  piggyLeftHurtEye[numOfPiggy]  = drawCircle(xPiggy - eyeIrisShiftX, yPiggy - ((1.5) * padding) + eyeIrisShiftY, 0, (OBSTACLE_ICE_SIZE/10) , 360, 0.5, 0.0, 0.5);
-  piggyRightHurtEye[numOfPiggy]  = drawCircle(xPiggy + eyeIrisShiftX, yPiggy - ((1.5) * padding) + eyeIrisShiftY, 0, (OBSTACLE_ICE_SIZE/10) , 360, 0.5, 0.0, 0.5);
+  stageMesh(staged, MESH_PIGGY_LEFT_EYE_SCLERA, index, circleMesh(xPiggy - eyeIrisShiftX - (padding/4), yPiggy - ((1.4) * padding) + eyeIrisShiftY, 0, (OBSTACLE_ICE_SIZE/20) , CIRCLE_SIDES, 0.0, 0.0, 0.0));
+  stageMesh(staged, MESH_PIGGY_RIGHT_EYE_SCLERA, index, circleMesh(xPiggy + eyeIrisShiftX + (padding/4), yPiggy - ((1.4) * padding) + eyeIrisShiftY, 0, (OBSTACLE_ICE_SIZE/20) , CIRCLE_SIDES, 0.0, 0.0, 0.0));
+  stageMesh(staged, MESH_PIGGY_LEFT_EYE_IRIS, index, circleMesh(xPiggy - eyeIrisShiftX, yPiggy - ((1.5) * padding) + eyeIrisShiftY, 0, (OBSTACLE_ICE_SIZE/10) , CIRCLE_SIDES, 1.0, 1.0, 1.0));
+  stageMesh(staged, MESH_PIGGY_RIGHT_EYE_IRIS, index, circleMesh(xPiggy + eyeIrisShiftX, yPiggy - ((1.5) * padding) + eyeIrisShiftY, 0, (OBSTACLE_ICE_SIZE/10) , CIRCLE_SIDES, 1.0, 1.0, 1.0));
+  stageMesh(staged, MESH_PIGGY_LEFT_HURT_EYE, index, circleMesh(xPiggy - eyeIrisShiftX, yPiggy - ((1.5) * padding) + eyeIrisShiftY, 0, (OBSTACLE_ICE_SIZE/10) , CIRCLE_SIDES, 0.5, 0.0, 0.5));
+  stageMesh(staged, MESH_PIGGY_RIGHT_HURT_EYE, index, circleMesh(xPiggy + eyeIrisShiftX, yPiggy - ((1.5) * padding) + eyeIrisShiftY, 0, (OBSTACLE_ICE_SIZE/10) , CIRCLE_SIDES, 0.5, 0.0, 0.5));
+
+  stageMesh(staged, MESH_PIGGY_NOSE, index, circleMesh(xPiggy, yPiggy - ((1.8) * padding), 0, (OBSTACLE_ICE_SIZE/9) , CIRCLE_SIDES, 0.0, 0.7, 0.0));
+  stageMesh(staged, MESH_PIGGY_FACE, index, circleMesh(xPiggy, yPiggy - padding, 0, (OBSTACLE_ICE_SIZE/2) - padding, CIRCLE_SIDES, 0.0, 1.0, 0.0));
+}
 
-  piggyNose[numOfPiggy] = drawCircle(xPiggy, yPiggy - ((1.8) * padding), 0, (OBSTACLE_ICE_SIZE/9) , 360, 0.0, 0.7, 0.0);
-  
-  piggyRadius[numOfPiggy] = (OBSTACLE_ICE_SIZE/2) - padding;
-  piggyX[numOfPiggy] = xPiggy; 
-  piggyY[numOfPiggy] = yPiggy - padding;
-  piggyFace[numOfPiggy++] = drawCircle(xPiggy, yPiggy - padding, 0, (OBSTACLE_ICE_SIZE/2) - padding, 360, 0.0, 1.0, 0.0);
+/* Hand a batch of finished meshes to the GL thread */
+void publishStaged(std::vector<StagedMesh> &staged)
+{
+  lock_guard<mutex> lock(stagedMutex);
+  stagedMeshes.insert(stagedMeshes.end(), make_move_iterator(staged.begin()), make_move_iterator(staged.end()));
+  staged.clear();
+}
 
+/* Every worker takes a stride of the entities, the simulation may already be moving them */
+void geometryWorker(int worker, int workers, const LevelBird *birds, int numBirds)
+{
+  vector<StagedMesh> staged;
+  for (int i = worker; i < numBirds; i += workers)
+    stageBird(staged, birds[i].size, birds[i].red, birds[i].blue, birds[i].green, i);
+  for (int i = worker; i < numOfPiggy && !geometryAbort; i += workers)
+  {
+    stagePiggy(staged, i, geometryPiggyY[i]);
+    if(staged.size() >= GEOMETRY_BATCH)
+      publishStaged(staged);
+  }
+  publishStaged(staged);
+  geometryPending--;
 }
 
+VAO **meshTarget(uint32_t kind, uint32_t index)
+{
+  switch(kind)
+  {
+    case MESH_BIRD_FACE: return &birdFace[index];
+    case MESH_BIRD_BEAK: return &birdBeak[index];
+    case MESH_BIRD_EYE_IRIS: return &birdEyeIris[index];
+    case MESH_BIRD_EYE_SCLERA: return &birdEyeSclera[index];
+    case MESH_PIGGY_FACE: return &piggyFace[index];
+    case MESH_PIGGY_NOSE: return &piggyNose[index];
+    case MESH_PIGGY_LEFT_EYE_IRIS: return &piggyLeftEyeIris[index];
+    case MESH_PIGGY_RIGHT_EYE_IRIS: return &piggyRightEyeIris[index];
+    case MESH_PIGGY_LEFT_EYE_SCLERA: return &piggyLeftEyeSclera[index];
+    case MESH_PIGGY_RIGHT_EYE_SCLERA: return &piggyRightEyeSclera[index];
+    case MESH_PIGGY_LEFT_HURT_EYE: return &piggyLeftHurtEye[index];
+    default: return &piggyRightHurtEye[index];
+  }
+}
 
-void createObstacle(GLint sizeOfMesh, GLfloat depth, GLfloat startX)
+/* FNV-1a 64 of everything the level geometry is built from and the tessellation settings */
+/* Bump GEOMETRY_CACHE_VERSION whenever the stage functions draw differently */
+uint64_t geometryCacheKey(const LevelBird *birds, int numBirds)
 {
-  float vertex_matrix[sizeOfMesh][sizeOfMesh];
-  float x =  (float)(startX + (OBSTACLE_ICE_SIZE/2));
-  float y = (float)(GROUND_HEIGHT + (OBSTACLE_ICE_SIZE/2));
-  float padding = 2.0f;
-  for (int i = 0; i < sizeOfMesh; i++)
+  uint32_t settings[] = {GEOMETRY_CACHE_VERSION, CIRCLE_SIDES, (uint32_t)numBirds, (uint32_t)numOfPiggy};
+  const void *parts[] = {settings, birds, piggyX, geometryPiggyY.data()};
+  size_t sizes[] = {sizeof(settings), numBirds * sizeof(LevelBird), numOfPiggy * sizeof(float), numOfPiggy * sizeof(float)};
+  uint64_t hash = 14695981039346656037ull;
+  for (int p = 0; p < 4; p++)
   {
-    for (int j = 0; j < sizeOfMesh; j++)
+    const unsigned char *bytes = (const unsigned char *)parts[p];
+    for (size_t i = 0; i < sizes[p]; i++)
     {
-      if(i < depth || i > sizeOfMesh - (depth + 1) || j < depth || j > sizeOfMesh - (depth + 1))
-      {
-        iceX[numOfIce] = x + (float)(i * OBSTACLE_ICE_SIZE);
-        iceY[numOfIce] = y + (float)(j * OBSTACLE_ICE_SIZE);
-        all[i][j].index = numOfIce;
-        all[i][j].x = iceX[numOfIce];
-        all[i][j].y = iceY[numOfIce];
-        all[i][j].isPiggy = false;
-        all[i][j].toReplace = false;
-        all[i][j].replacing = 0;
-        iceBoundingCircle[numOfIce] =  (OBSTACLE_ICE_SIZE / 2) - padding;
-        iceBricksOutline[numOfIce] = drawRectangle(iceX[numOfIce], iceY[numOfIce], 0.0f, iceBoundingCircle[numOfIce] + padding, iceBoundingCircle[numOfIce] + padding, 0.65f, 0.94f, 0.95f, false);
-        iceBricks[numOfIce] = drawRectangle(iceX[numOfIce], iceY[numOfIce], 0.0f, iceBoundingCircle[numOfIce], iceBoundingCircle[numOfIce], 0.65f, 0.94f, 0.95f, true);
-        iceBreakLines[numOfIce] = drawCircle(iceX[numOfIce], iceY[numOfIce], 0.0f, (2*iceBoundingCircle[numOfIce])/3, 7, 0.0, 0.0, 1.0);
-        numOfIce++;
-      }
-      else
-      {
-        all[i][j].index = numOfPiggy;
-        all[i][j].isPiggy = true;
-        all[i][j].toReplace = false;
-        all[i][j].replacing = 0;
-        createPiggy(x + (float)(i * OBSTACLE_ICE_SIZE), y + (float)(j * OBSTACLE_ICE_SIZE));
-      }
+      hash ^= bytes[i];
+      hash *= 1099511628211ull;
     }
   }
+  return hash;
 }
 
+std::string geometryCachePath(uint64_t key)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "%s/%016llx.bin", GEOMETRY_CACHE_DIR, (unsigned long long)key);
+  return path;
+}
 
-float camera_rotation_angle = 90;
-/* Render the scene with openGL */
-/* Edit this function according to your assignment */
+/* Maps a cache file and checks every record up front, uploads then read it without checks */
+bool loadGeometryCache(const std::string &path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+  struct stat info;
+  if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(GeometryCacheHeader))
+  {
+    close(fd);
+    return false;
+  }
+  size_t size = info.st_size;
+  char *data = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED)
+    return false;
+  const GeometryCacheHeader *header = (const GeometryCacheHeader *)data;
+  bool valid = memcmp(header->magic, GEOMETRY_CACHE_MAGIC, 4) == 0 && header->version == GEOMETRY_CACHE_VERSION && header->key == geometryKey;
+  uint64_t offset = sizeof(GeometryCacheHeader);
+  for (uint32_t m = 0; valid && m < header->numMeshes; m++)
+  {
+    valid = offset + sizeof(GeometryCacheMesh) <= size;
+    if(!valid)
+      break;
+    const GeometryCacheMesh *mesh = (const GeometryCacheMesh *)(data + offset);
+    valid = mesh->kind < MESH_KIND_COUNT && (int)mesh->index < (mesh->kind < MESH_PIGGY_FACE ? numOfBirds : numOfPiggy);
+    offset += sizeof(GeometryCacheMesh) + 6 * (uint64_t)mesh->numVertices * sizeof(GLfloat);
+  }
+  if(!valid || offset != size)
+  {
+    munmap(data, size);
+    return false;
+  }
+  geometryCacheData = data;
+  geometryCacheSize = size;
+  geometryCacheNext = sizeof(GeometryCacheHeader);
+  return true;
+}
 
-glm::mat4 rotateBird[10];
-glm::mat4 translateBird[10];
+/* Uploads go straight from the mapping, no mesh is tessellated or copied */
+void uploadCachedGeometry(double budget)
+{
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  while(geometryCacheNext < geometryCacheSize)
+  {
+    const GeometryCacheMesh *mesh = (const GeometryCacheMesh *)(geometryCacheData + geometryCacheNext);
+    const GLfloat *vertices = (const GLfloat *)(mesh + 1);
+    *meshTarget(mesh->kind, mesh->index) = create3DObject(mesh->primitiveMode, mesh->numVertices, vertices, vertices + 3 * mesh->numVertices, mesh->fillMode);
+    geometryCacheNext += sizeof(GeometryCacheMesh) + 6 * mesh->numVertices * sizeof(GLfloat);
+    if(budget >= 0 && chrono::duration<double>(chrono::steady_clock::now() - start).count() >= budget)
+      return;
+  }
+  munmap(geometryCacheData, geometryCacheSize);
+  geometryCacheData = NULL;
+}
 
-void draw ()
+void appendGeometryRecord(const StagedMesh &item)
 {
-  // clear the color and depth in the frame buffer
-  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  GeometryCacheMesh record = {item.kind, item.index, item.mesh.primitiveMode, item.mesh.fillMode, (uint32_t)(item.mesh.vertices.size() / 3)};
+  const char *bytes = (const char *)&record;
+  geometryCacheOut.insert(geometryCacheOut.end(), bytes, bytes + sizeof(record));
+  bytes = (const char *)item.mesh.vertices.data();
+  geometryCacheOut.insert(geometryCacheOut.end(), bytes, bytes + item.mesh.vertices.size() * sizeof(GLfloat));
+  bytes = (const char *)item.mesh.colors.data();
+  geometryCacheOut.insert(geometryCacheOut.end(), bytes, bytes + item.mesh.colors.size() * sizeof(GLfloat));
+  geometryCacheCount++;
+}
 
-  // use the loaded shader program
-  // Don't change unless you know what you are doing
-  glUseProgram (programID);
+/* Written aside and renamed like the shader cache, a failed write only costs the next launch a rebuild */
+void saveGeometryCache()
+{
+  GeometryCacheHeader header;
+  memcpy(header.magic, GEOMETRY_CACHE_MAGIC, 4);
+  header.version = GEOMETRY_CACHE_VERSION;
+  header.key = geometryKey;
+  header.numMeshes = geometryCacheCount;
+  header.reserved = 0;
+  mkdir(GEOMETRY_CACHE_DIR, 0755);
+  std::string path = geometryCachePath(geometryKey);
+  std::string temp = path + ".tmp";
+  FILE *file = fopen(temp.c_str(), "wb");
+  if(file)
+  {
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(geometryCacheOut.data(), 1, geometryCacheOut.size(), file) == geometryCacheOut.size();
+    if(fclose(file) == 0 && written)
+      rename(temp.c_str(), path.c_str());
+    else
+      remove(temp.c_str());
+  }
+  vector<char>().swap(geometryCacheOut);
+}
 
-  // Eye - Location of camera. Don't change unless you are sure!!
-  glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
-  // Target - Where is the camera looking at.  Don't change unless you are sure!!
-  glm::vec3 target (0, 0, 0);
-  // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
-  glm::vec3 up (0, 1, 0);
+void startGeometryBuild(const LevelBird *birds, int numBirds)
+{
+  // Starting positions are copied, the workers never read state the simulation writes
+  geometryPiggyY.assign(piggyY, piggyY + numOfPiggy);
+  geometryKey = geometryCacheKey(birds, numBirds);
+  geometryCacheHit = loadGeometryCache(geometryCachePath(geometryKey));
+  if(geometryCacheHit)
+    return;
+  geometryCacheOut.clear();
+  geometryCacheCount = 0;
+  int workers = max(1, min((int)thread::hardware_concurrency(), GEOMETRY_WORKERS_MAX));
+  geometryAbort = false;
+  geometryPending = workers;
+  for (int w = 0; w < workers; w++)
+    geometryWorkers.push_back(thread(geometryWorker, w, workers, birds, numBirds));
+}
 
-  // Compute Camera matrix (view)
-  // Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
-  //  Don't change unless you are sure!!
-  Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+/* GL thread side, uploads staged meshes until budget seconds are spent, a negative budget uploads everything ready */
+void uploadStagedGeometry(double budget)
+{
+  if(geometryCacheData)
+    uploadCachedGeometry(budget);
+  if(geometryWorkers.empty())
+    return;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  bool finished = geometryPending == 0;
+  {
+    lock_guard<mutex> lock(stagedMutex);
+    uploadQueue.insert(uploadQueue.end(), make_move_iterator(stagedMeshes.begin()), make_move_iterator(stagedMeshes.end()));
+    stagedMeshes.clear();
+  }
+  while(uploadNext < uploadQueue.size())
+  {
+    StagedMesh &item = uploadQueue[uploadNext];
+    *meshTarget(item.kind, item.index) = uploadMesh(item.mesh);
+    appendGeometryRecord(item);
+    uploadNext++;
+    if(budget >= 0 && chrono::duration<double>(chrono::steady_clock::now() - start).count() >= budget)
+      return;
+  }
+  uploadQueue.clear();
+  uploadNext = 0;
+  if(finished)
+  {
+    for (size_t w = 0; w < geometryWorkers.size(); w++)
+      geometryWorkers[w].join();
+    geometryWorkers.clear();
+    saveGeometryCache();
+  }
+}
 
-  // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
-  //  Don't change unless you are sure!!
-  glm::mat4 VP = Matrices.projection * Matrices.view;
+/* Block until the whole level is uploaded, benchmarks measure complete frames */
+void finishGeometryBuild()
+{
+  while(!geometryWorkers.empty() || geometryCacheData)
+  {
+    uploadStagedGeometry(-1);
+    this_thread::yield();
+  }
+}
+
+void stopGeometryBuild()
+{
+  geometryAbort = true;
+  for (size_t w = 0; w < geometryWorkers.size(); w++)
+    geometryWorkers[w].join();
+  geometryWorkers.clear();
+  if(geometryCacheData)
+  {
+    munmap(geometryCacheData, geometryCacheSize);
+    geometryCacheData = NULL;
+  }
+}
+
+/* Point the simulation at a validated level image, its arrays are used in place */
+void bindLevel(char *data)
+{
+  LevelHeader *header = (LevelHeader *)data;
+  LevelBird *birds = (LevelBird *)(data + header->birds);
+  levelState = data + header->iceX;
+  levelStateBytes = header->cellSlots - header->iceX;
+  numOfIce = header->numIce;
+  iceX = (float *)(data + header->iceX);
+  iceY = (float *)(data + header->iceY);
+  iceBoundingCircle = (float *)(data + header->iceBoundingCircle);
+  iceTranslate = (float *)(data + header->iceTranslate);
+  iceBroken = (int *)(data + header->iceBroken);
+  colIce = (bool *)(data + header->colIce);
+  numOfPiggy = header->numPiggy;
+  piggyX = (float *)(data + header->piggyX);
+  piggyY = (float *)(data + header->piggyY);
+  piggyRadius = (float *)(data + header->piggyRadius);
+  piggyTranslate = (float *)(data + header->piggyTranslate);
+  piggyHurt = (int *)(data + header->piggyHurt);
+  colPiggy = (bool *)(data + header->colPiggy);
+  grid = (Obstacle *)(data + header->cells);
+  cellSlots = (uint32_t *)(data + header->cellSlots);
+  slotCapacity = header->slotCapacity;
+  columnTops = (int32_t *)(data + header->columnTops);
+  numColumns = header->numColumns;
+  iceCell = (int32_t *)(data + header->iceCell);
+  piggyCell = (int32_t *)(data + header->piggyCell);
+
+  for (unsigned int i = 0; i < header->numBirds; i++)
+    createBird(birds[i].size, i, birds[i].type);
+  birdStatus[0] = 1;
+
+  iceBounds.resize(numOfIce);
+  for (int i = 0; i < numOfIce; i++)
+    iceBounds[i] = makeBounds(iceX[i] - OBSTACLE_ICE_SIZE/2, iceY[i] - OBSTACLE_ICE_SIZE/2, iceX[i] + OBSTACLE_ICE_SIZE/2, iceY[i] + OBSTACLE_ICE_SIZE/2);
+  piggyBounds.resize(numOfPiggy);
+  for (int i = 0; i < numOfPiggy; i++)
+    piggyBounds[i] = makeBounds(piggyX[i] - OBSTACLE_ICE_SIZE/2, piggyY[i] + 5.0f - OBSTACLE_ICE_SIZE/2, piggyX[i] + OBSTACLE_ICE_SIZE/2, piggyY[i] + 5.0f + OBSTACLE_ICE_SIZE/2);
+  for (int k = 0; k < 3; k++)
+  {
+    snapshots[k].iceBroken.resize(numOfIce);
+    snapshots[k].iceTranslate.resize(numOfIce);
+    snapshots[k].piggyHurt.resize(numOfPiggy);
+    snapshots[k].piggyTranslate.resize(numOfPiggy);
+  }
+
+  // Headless runs never draw, windowed ones get their geometry built in the background
+  if(headless)
+    return;
+  iceBrickInstances.resize(3 * numOfIce + 3);
+  iceOutlineInstances.resize(3 * numOfIce + 3);
+  iceBreakInstances.resize(3 * numOfIce + 3);
+  piggyFace.assign(numOfPiggy, NULL);
+  piggyNose.assign(numOfPiggy, NULL);
+  piggyLeftEyeIris.assign(numOfPiggy, NULL);
+  piggyRightEyeIris.assign(numOfPiggy, NULL);
+  piggyLeftEyeSclera.assign(numOfPiggy, NULL);
+  piggyRightEyeSclera.assign(numOfPiggy, NULL);
+  piggyLeftHurtEye.assign(numOfPiggy, NULL);
+  piggyRightHurtEye.assign(numOfPiggy, NULL);
+  startGeometryBuild(birds, header->numBirds);
+}
+
+/* Map a level file copy-on-write, the simulation writes into its own private pages */
+/* The mapping of a level loaded before is released once the new one is bound */
+bool loadLevelFile(const char *path)
+{
+  static void *mapping = NULL;
+  static size_t mappingBytes = 0;
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return false;
+  struct stat info;
+  if(fstat(fd, &info) != 0 || info.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+  void *data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED)
+    return false;
+  string error;
+  if(!levelValidate((char *)data, info.st_size, error))
+  {
+    cout << "Error: Level `" << path << "': " << error << endl;
+    munmap(data, info.st_size);
+    return false;
+  }
+  bindLevel((char *)data);
+  if(mapping)
+    munmap(mapping, mappingBytes);
+  mapping = data;
+  mappingBytes = info.st_size;
+  return true;
+}
+
+/* Built in levels go through the same image as level files */
+void useLevel(const LevelBuilder &builder)
+{
+  string error;
+  if(!levelBuild(builder, levelImage, error))
+  {
+    cout << "Error: Could not build level: " << error << endl;
+    exit(EXIT_FAILURE);
+  }
+  bindLevel(&levelImage[0]);
+}
+
+void loadLevel()
+{
+  if(!loadLevelFile(levelPath))
+  {
+    cout << "Error: Could not load level `" << levelPath << "'" << endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Benchmark scenes run on --level instead of their own tower when one is given */
+void useBenchLevel(const LevelBuilder &builder)
+{
+  if(levelPath)
+    loadLevel();
+  else
+    useLevel(builder);
+}
+
+
+GLFWwindow* window; // window desciptor/handle
+
+/* FNV-1a over the simulation state, used to check that a replay reproduced its recording */
+uint32_t hashBytes(uint32_t hash, const void *data, size_t length)
+{
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < length; i++)
+  {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+uint32_t simStateHash()
+{
+  uint32_t hash = 2166136261u;
+  // The spare slot past the last bird is left out, hashes stay what they were with ten
+  hash = hashBytes(hash, birdStatus, LEVEL_MAX_BIRDS * sizeof(int));
+  hash = hashBytes(hash, birdDisplaceX, sizeof(birdDisplaceX));
+  hash = hashBytes(hash, birdDisplaceY, sizeof(birdDisplaceY));
+  hash = hashBytes(hash, birdSize, sizeof(birdSize));
+  hash = hashBytes(hash, phy_x, sizeof(phy_x));
+  hash = hashBytes(hash, phy_y, sizeof(phy_y));
+  hash = hashBytes(hash, iceBroken, numOfIce * sizeof(int));
+  hash = hashBytes(hash, iceTranslate, numOfIce * sizeof(float));
+  hash = hashBytes(hash, piggyHurt, numOfPiggy * sizeof(int));
+  hash = hashBytes(hash, piggyTranslate, numOfPiggy * sizeof(float));
+  hash = hashBytes(hash, &canon_tunnel_angle, sizeof(canon_tunnel_angle));
+  hash = hashBytes(hash, &canonMomentum, sizeof(canonMomentum));
+  hash = hashBytes(hash, &score, sizeof(score));
+  return hash;
+}
+
+template <typename T> void syncWorldField(T &global, T &stored, bool save)
+{
+  if(save)
+    memcpy(&stored, &global, sizeof(T));
+  else
+    memcpy(&global, &stored, sizeof(T));
+}
+
+/* Copies every simulation global to the snapshot when saving, back from it when restoring */
+void syncWorldScalars(WorldScalars &world, bool save)
+{
+  syncWorldField(birdStatus, world.birdStatus, save);
+  syncWorldField(birdType, world.birdType, save);
+  syncWorldField(birdDisplaceX, world.birdDisplaceX, save);
+  syncWorldField(birdDisplaceY, world.birdDisplaceY, save);
+  syncWorldField(birdSize, world.birdSize, save);
+  syncWorldField(birdTime, world.birdTime, save);
+  syncWorldField(birdSpecial, world.birdSpecial, save);
+  syncWorldField(restore, world.restore, save);
+  syncWorldField(score, world.score, save);
+  syncWorldField(over, world.over, save);
+  syncWorldField(canonMomentum, world.canonMomentum, save);
+  syncWorldField(canon_tunnel_rotation, world.canon_tunnel_rotation, save);
+  syncWorldField(canon_tunnel_angle, world.canon_tunnel_angle, save);
+  syncWorldField(phy_ux, world.phy_ux, save);
+  syncWorldField(phy_uy, world.phy_uy, save);
+  syncWorldField(phy_vy, world.phy_vy, save);
+  syncWorldField(phy_time, world.phy_time, save);
+  syncWorldField(phy_x, world.phy_x, save);
+  syncWorldField(phy_y, world.phy_y, save);
+  syncWorldField(phy_angle, world.phy_angle, save);
+  syncWorldField(bird_storeX, world.bird_storeX, save);
+  syncWorldField(bird_storeY, world.bird_storeY, save);
+  syncWorldField(phy_index, world.phy_index, save);
+  syncWorldField(phy_start, world.phy_start, save);
+  syncWorldField(physics, world.physics, save);
+  syncWorldField(worldKey, world.worldKey, save);
+}
+
+/* Whole simulation state as one flat blob, the scalars followed by the writable range of the level image */
+/* sim_tick is left out so input logs keep counting through a restore */
+void saveWorld(std::vector<char> &blob)
+{
+  WorldScalars world;
+  syncWorldScalars(world, true);
+  world.levelKey = levelKey;
+  blob.resize(sizeof(world) + levelStateBytes);
+  memcpy(blob.data(), &world, sizeof(world));
+  memcpy(blob.data() + sizeof(world), levelState, levelStateBytes);
+}
+
+/* Fails on a blob saved from another level */
+bool restoreWorld(const std::vector<char> &blob)
+{
+  WorldScalars world;
+  if(blob.size() != sizeof(world) + levelStateBytes)
+    return false;
+  memcpy(&world, blob.data(), sizeof(world));
+  if(world.levelKey != levelKey)
+    return false;
+  syncWorldScalars(world, false);
+  memcpy(levelState, blob.data() + sizeof(world), levelStateBytes);
+  return true;
+}
+
+void changeMomentum(int val)
+{
+  float temp = canonMomentum + val;
+  if(temp >= CANON_MIN_MOM and temp <= CANON_MAX_MOM)
+    canonMomentum = temp;
+}
+
+/* Trial shots and tool runs drive the simulation themselves, no live or replayed input may reach it */
+void suppressReplay()
+{
+  replaying = true;
+  replayCursor = replayLog.size();
+}
+
+/* Apply one input event to the game state, the only place where input touches the simulation */
+void applyInput(InputEvent event)
+{
+  if(event.code >= INPUT_MOUSE_BASE)
+  {
+    switch (event.code - INPUT_MOUSE_BASE) {
+        case GLFW_MOUSE_BUTTON_LEFT:
+            if (event.action == GLFW_RELEASE)
+                canon_tunnel_rotation = 0.0f;
+            else if(event.action == GLFW_PRESS)
+              canon_tunnel_rotation = CANON_ROTATION;
+            break;
+        case GLFW_MOUSE_BUTTON_RIGHT:
+            if (event.action == GLFW_RELEASE)
+                canon_tunnel_rotation = 0.0f;
+            else
+              canon_tunnel_rotation = -CANON_ROTATION;
+            break;
+        default:
+            break;
+    }
+    return;
+  }
+
+  switch (event.code) {
+      case GLFW_KEY_SPACE:
+          if(!phy_start)
+          {
+            phy_start = true;
+            phy_angle = canon_tunnel_angle;
+            phy_ux = canonMomentum * simCos(canon_tunnel_angle);
+            phy_uy = canonMomentum * simSin(canon_tunnel_angle);
+            for (int i = 0; i < numOfPiggy; ++i)
+              colPiggy[i] = true;
+            for (int i = 0; i < numOfIce; ++i)
+              colIce[i] = true;
+          }
+          break;
+      case GLFW_KEY_RIGHT:
+          changeMomentum(MOMENTUM_STEP);
+          break;
+      case GLFW_KEY_LEFT:
+          changeMomentum(-MOMENTUM_STEP);
+          break;
+      // The view follows the zoom level on the render thread
+      case GLFW_KEY_KP_ADD:
+          zoomLevel++;
+          break;
+      case GLFW_KEY_KP_SUBTRACT:
+          zoomLevel--;
+          break;
+      case GLFW_KEY_P:
+          birdSpecial[phy_index] = true;
+          restore = 5.00;
+          break;
+      // Restart is an input like any other, so recordings replay through it
+      case GLFW_KEY_R:
+          restoreWorld(levelStart);
+          break;
+      default:
+          break;
+  }
+}
+
+/* Input callbacks only queue events, they take effect at the start of the next tick */
+void queueInput(int code, int action)
+{
+  if(replaying)
+    return;
+  InputEvent event;
+  event.tick = 0;
+  event.code = (uint16_t)code;
+  event.action = (uint16_t)action;
+  lock_guard<mutex> lock(inputMutex);
+  pendingInput.push_back(event);
+}
+
+void applyPendingInput()
+{
+  if(replaying)
+  {
+    while(replayCursor < replayLog.size() && replayLog[replayCursor].tick == sim_tick)
+      applyInput(replayLog[replayCursor++]);
+    return;
+  }
+  vector<InputEvent> events;
+  {
+    lock_guard<mutex> lock(inputMutex);
+    events.swap(pendingInput);
+  }
+  for (size_t i = 0; i < events.size(); i++)
+  {
+    events[i].tick = sim_tick;
+    if(recordFile)
+      fwrite(&events[i], sizeof(InputEvent), 1, recordFile);
+    applyInput(events[i]);
+  }
+}
+
+/* Input log: magic, version, then 8 byte events in tick order (host byte order, little-endian on x86) */
+/* Sessions recorded in deterministic mode start with an INPUT_DETERMINISTIC marker */
+bool startRecording(const char *path)
+{
+  recordFile = fopen(path, "wb");
+  if(!recordFile)
+    return false;
+  uint32_t version = INPUT_LOG_VERSION;
+  fwrite(INPUT_LOG_MAGIC, 1, 4, recordFile);
+  fwrite(&version, sizeof(version), 1, recordFile);
+  // A marker ahead of the events, the replay has to run the same physics
+  if(deterministicPhysics)
+  {
+    InputEvent mode = {0, INPUT_DETERMINISTIC, 0};
+    fwrite(&mode, sizeof(mode), 1, recordFile);
+  }
+  return true;
+}
+
+/* The end marker is followed by the final tick count, score and state hash for replay checks */
+void finishRecording()
+{
+  if(!recordFile)
+    return;
+  InputEvent end;
+  end.tick = sim_tick;
+  end.code = INPUT_END;
+  end.action = 0;
+  InputLogFooter footer;
+  footer.ticks = sim_tick;
+  footer.score = score;
+  footer.stateHash = simStateHash();
+  fwrite(&end, sizeof(end), 1, recordFile);
+  fwrite(&footer, sizeof(footer), 1, recordFile);
+  fclose(recordFile);
+  recordFile = NULL;
+}
+
+bool loadReplay(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if(!file)
+    return false;
+  char magic[4];
+  uint32_t version = 0;
+  if(fread(magic, 1, 4, file) != 4 || memcmp(magic, INPUT_LOG_MAGIC, 4) != 0 || fread(&version, sizeof(version), 1, file) != 1 || version < 1 || version > INPUT_LOG_VERSION)
+  {
+    fclose(file);
+    return false;
+  }
+  InputEvent event;
+  bool ended = false;
+  while(fread(&event, sizeof(event), 1, file) == 1)
+  {
+    if(event.code == INPUT_END)
+    {
+      ended = fread(&replayFooter, sizeof(replayFooter), 1, file) == 1;
+      break;
+    }
+    if(event.code == INPUT_DETERMINISTIC)
+      deterministicPhysics = true;
+    else
+      replayLog.push_back(event);
+  }
+  fclose(file);
+  replayVersion = version;
+  if(!ended)
+  {
+    // Session was cut short, replay whatever was captured
+    replayFooter.ticks = replayLog.empty() ? 0 : replayLog.back().tick + 1;
+    replayFooter.score = -1;
+    replayFooter.stateHash = 0;
+  }
+  replaying = true;
+  return true;
+}
+
+/* Compare the end of a replay against its recording, returns the process exit status */
+int reportReplay(double seconds)
+{
+  uint32_t hash = simStateHash();
+  printf("replay: %u ticks in %.3f s (%.0f ticks/s)\n", sim_tick, seconds, seconds > 0 ? sim_tick / seconds : 0.0);
+  printf("replay: score %d, state hash %08x\n", score, hash);
+  if(replayFooter.score < 0)
+    return EXIT_SUCCESS;
+  // The hash of a version 1 log covered the whole obstacle arrays, only its score can still be compared
+  bool checkHash = replayVersion >= 2;
+  if(!checkHash)
+    printf("replay: version 1 recording, state hash not checked\n");
+  if(replayFooter.score != score || (checkHash && replayFooter.stateHash != hash))
+  {
+    printf("replay: MISMATCH, recorded score %d, state hash %08x\n", replayFooter.score, replayFooter.stateHash);
+    return EXIT_FAILURE;
+  }
+  printf("replay: matches recording\n");
+  return EXIT_SUCCESS;
+}
+
+/* Advance the game by exactly one simulation tick */
+/* Every state change happens here, so a recorded session replays identically */
+void simulate()
+{
+  applyPendingInput();
+
+  for (int i = 0; i < numOfBirds; i++)
+  {
+    if(birdStatus[i] == 1)
+    {
+      if((20.0f + ((CANON_TUNNEL_LENGTH * simSin(phy_angle)) + birdDisplaceY[i])) <= 0)
+      {
+        birdDisplaceY[i] = -1*(20.0f + (CANON_TUNNEL_LENGTH * simSin(phy_angle)));
+        if(phy_ux < physics.velocityMin)
+        {
+          phy_start = false;
+          birdStatus[i + 1] = 1;
+          birdStatus[i] = 2;
+        }
+        else
+        {
+          stamp(0.5, -physics.groundRebound);
+          physics_engine();
+        }
+      }
+      else
+      {
+        physics_engine();
+        phy_index = i;
+      }
+    }
+    else if(birdStatus[i] == 2)
+    {
+      if(birdTime[i] < 5.0)
+      {
+        birdSpecial[i] = false;
+        birdTime[i]+=0.05;
+      }
+    }
+    if(birdSpecial[i] && restore > 0)
+    {
+        if(birdType[i] == 2 && birdStatus[i] < 2)
+        {
+          birdSize[i]*=1.2;
+          restore -= 0.5;
+        }
+        else if(birdType[i] == 3)
+        {
+          stamp(2, 2);
+          restore = 0.0;
+        }
+    }
+    else
+    {
+      if(birdType[i]==2)
+        birdSize[i] = 15.0f;
+    }
+  }
+
+  checkFall();
+
+  if(canon_tunnel_angle + canon_tunnel_rotation >= 0 and canon_tunnel_angle + canon_tunnel_rotation < (M_PI/3))
+    canon_tunnel_angle += canon_tunnel_rotation;
+
+  sim_tick++;
+}
+
+/* Bird waiting in the canon, -1 while one is flying or none are left */
+int loadedBird()
+{
+  if(phy_start)
+    return -1;
+  for (int i = 0; i < numOfBirds; i++)
+    if(birdStatus[i] == 1)
+      return i;
+  return -1;
+}
+
+/* Every aim and momentum the player can reach, with the same float steps applyInput takes */
+void reachableAngles(std::vector<float> &angles, std::vector<int> &aimTicks)
+{
+  float angle = canon_tunnel_angle;
+  for (int ticks = 0; angle >= 0 && angle < (M_PI/3); ticks--, angle += -CANON_ROTATION)
+  {
+    angles.push_back(angle);
+    aimTicks.push_back(ticks);
+  }
+  angle = canon_tunnel_angle + CANON_ROTATION;
+  for (int ticks = 1; angle >= 0 && angle < (M_PI/3); ticks++, angle += CANON_ROTATION)
+  {
+    angles.push_back(angle);
+    aimTicks.push_back(ticks);
+  }
+}
+
+void reachableMomenta(std::vector<float> &momenta, std::vector<int> &steps)
+{
+  float momentum = canonMomentum;
+  int step = 0;
+  while(momentum - MOMENTUM_STEP >= CANON_MIN_MOM)
+  {
+    momentum -= MOMENTUM_STEP;
+    step--;
+  }
+  for (; momentum <= CANON_MAX_MOM; momentum += MOMENTUM_STEP, step++)
+  {
+    momenta.push_back(momentum);
+    steps.push_back(step);
+  }
+}
+
+/* Closed form of physics_engine for the loaded bird: from the muzzle x gains m*cos(a)*t and y gains */
+/* m*sin(a)*t - g*t*t/2. At the target's x, t = dx/(m*cos(a)), so the arc passes targetY + e when */
+/* m*m = g*dx*dx / (2*cos(a)*cos(a)*(y0 + dx*tan(a) - targetY - e)). An arc of slope k there passes */
+/* within reach when |e| <= reach*sqrt(1 + k*k), so every angle gives the interval of momenta passing the */
+/* widest such window above or below the target, and only grid momenta in it are checked and emitted. */
+/* Bounces and obstacles on the way are not modelled, verifyShot catches those */
+void solveShot(float targetX, float targetY, float reach, std::vector<ShotSolution> &solutions)
+{
+  solutions.clear();
+  int bird = loadedBird();
+  if(bird < 0)
+    return;
+  std::vector<float> angles, momenta;
+  std::vector<int> aimTicks, steps;
+  reachableAngles(angles, aimTicks);
+  reachableMomenta(momenta, steps);
+  if(momenta.empty())
+    return;
+  float temp = (float)GROUND_HEIGHT + birdSize[bird];
+  for (size_t a = 0; a < angles.size(); a++)
+  {
+    double c = simCos(angles[a]), sn = simSin(angles[a]);
+    double x0 = 60.0f + CANON_TUNNEL_LENGTH * c + bird_storeX[bird] + temp;
+    double y0 = 20.0f + CANON_TUNNEL_LENGTH * sn + bird_storeY[bird] + temp;
+    double dx = targetX - x0;
+    // Height the arc would have at the target without gravity, above the target
+    double rise = y0 + dx * sn / c - targetY;
+    if(dx <= 0)
+      continue;
+    // The slope at the target grows with the momentum, the window is widest at one end of the grid
+    double drop = physics.gravity * dx * dx / (2 * c * c);
+    double slopeLow = sn / c - 2 * drop / (dx * momenta.front() * momenta.front());
+    double slopeHigh = sn / c - 2 * drop / (dx * momenta.back() * momenta.back());
+    double window = reach * sqrt(1 + max(slopeLow * slopeLow, slopeHigh * slopeHigh));
+    // Passing below the target takes the least momentum, passing above it the most
+    if(rise + window <= 0)
+      continue;
+    double lowest = sqrt(drop / (rise + window));
+    double highest = rise - window > 0 ? sqrt(drop / (rise - window)) : CANON_MAX_MOM;
+    int first = max(0, (int)ceil((lowest - momenta[0]) / MOMENTUM_STEP));
+    int last = min((int)momenta.size() - 1, (int)floor((highest - momenta[0]) / MOMENTUM_STEP));
+    for (int m = first; m <= last; m++)
+    {
+      double squared = (double)momenta[m] * momenta[m];
+      double miss = rise - drop / squared;
+      double slope = sn / c - 2 * drop / (dx * squared);
+      if(miss * miss > reach * reach * (1 + slope * slope))
+        continue;
+      ShotSolution shot = {angles[a], aimTicks[a], momenta[m], steps[m], (float)(dx / (momenta[m] * c)), false};
+      solutions.push_back(shot);
+    }
+  }
+}
+
+/* Sets the canon exactly as aiming would and launches the loaded bird */
+void fireBird(float angle, float momentum)
+{
+  canon_tunnel_angle = angle;
+  canon_tunnel_rotation = 0;
+  canonMomentum = momentum;
+  InputEvent fire = {sim_tick, GLFW_KEY_SPACE, GLFW_PRESS};
+  applyInput(fire);
+}
+
+/* Fires the shot in a headless simulation from the current state and reports whether the piggy was hit */
+/* The world, tick and input cursors are all put back afterwards */
+bool verifyShot(const ShotSolution &shot, int piggy)
+{
+  int bird = loadedBird();
+  if(bird < 0)
+    return false;
+  std::vector<char> before;
+  saveWorld(before);
+  unsigned int tick = sim_tick;
+  size_t cursor = replayCursor;
+  bool wasReplaying = replaying;
+  suppressReplay();
+
+  fireBird(shot.angle, shot.momentum);
+  int hurt = piggyHurt[piggy];
+  bool hit = false;
+  for (int t = 0; t < SOLVER_VERIFY_TICKS && birdStatus[bird] == 1 && !hit; t++)
+  {
+    simulate();
+    hit = piggyHurt[piggy] != hurt;
+  }
+
+  replaying = wasReplaying;
+  replayCursor = cursor;
+  sim_tick = tick;
+  restoreWorld(before);
+  return hit;
+}
+
+/* --solve, every confirmed shot at every piggy of the level */
+int reportSolutions()
+{
+  int bird = loadedBird();
+  if(bird < 0)
+  {
+    printf("solve: no bird left to fire\n");
+    return EXIT_FAILURE;
+  }
+  std::vector<ShotSolution> solutions;
+  for (int i = 0; i < numOfPiggy; i++)
+  {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    solveShot(piggyX[i], piggyY[i], piggyRadius[i] + birdSize[bird], solutions);
+    double solveSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    int confirmed = 0;
+    for (size_t s = 0; s < solutions.size(); s++)
+    {
+      solutions[s].confirmed = verifyShot(solutions[s], i);
+      confirmed += solutions[s].confirmed;
+    }
+    double verifySeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count() - solveSeconds;
+    printf("solve: piggy %d at (%.1f, %.1f): %lu arcs in %.1f us, %d confirmed in %.1f ms\n", i, piggyX[i], piggyY[i], (unsigned long)solutions.size(), 1e6 * solveSeconds, confirmed, 1e3 * verifySeconds);
+    for (size_t s = 0; s < solutions.size(); s++)
+      if(solutions[s].confirmed)
+        printf("solve:   angle %.2f (%+d aim ticks), momentum %.0f (%+d steps), contact after %.1f\n", solutions[s].angle, solutions[s].aimTicks, solutions[s].momentum, solutions[s].momentumSteps, solutions[s].flightTime);
+  }
+  return EXIT_SUCCESS;
+}
+
+/* Forks one child per worker, each runs job on its own copy-on-write copy of the world */
+/* The simulation lives in process globals, so this is how it runs on every core */
+/* Returns each worker's output in order, a worker that died leaves its entry empty */
+void forkWorkers(int workers, void (*job)(int worker, FILE *out), std::vector<std::string> &outputs)
+{
+  std::vector<pid_t> pids(workers, -1);
+  std::vector<int> pipes(workers, -1);
+  fflush(stdout);
+  for (int w = 0; w < workers; w++)
+  {
+    int ends[2];
+    if(pipe(ends) != 0)
+      break;
+    pids[w] = fork();
+    if(pids[w] == 0)
+    {
+      close(ends[0]);
+      FILE *out = fdopen(ends[1], "wb");
+      job(w, out);
+      fclose(out);
+      _exit(EXIT_SUCCESS);
+    }
+    close(ends[1]);
+    if(pids[w] < 0)
+      close(ends[0]);
+    else
+      pipes[w] = ends[0];
+  }
+  // Workers never wait on each other, so reading them one after another cannot deadlock
+  outputs.assign(workers, std::string());
+  char buffer[4096];
+  for (int w = 0; w < workers; w++)
+  {
+    if(pipes[w] < 0)
+      continue;
+    ssize_t length;
+    while((length = read(pipes[w], buffer, sizeof(buffer))) > 0)
+      outputs[w].append(buffer, length);
+    close(pipes[w]);
+    int status = 0;
+    waitpid(pids[w], &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+      outputs[w].clear();
+  }
+}
+
+/* splitmix64, every search worker gets its own seeded stream */
+uint64_t nextRandom(uint64_t &state)
+{
+  uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+/* Every MCTS_ANGLE_STRIDE-th reachable angle and every momentum step, what the searches and sweeps fire */
+void buildShotGrid()
+{
+  for (float angle = 0; angle < (M_PI/3); )
+  {
+    mctsAngles.push_back(angle);
+    for (int i = 0; i < MCTS_ANGLE_STRIDE; i++)
+      angle += CANON_ROTATION;
+  }
+  for (float momentum = CANON_MIN_MOM; momentum <= CANON_MAX_MOM; momentum += MOMENTUM_STEP)
+    mctsMomenta.push_back(momentum);
+}
+
+int mctsActionCount()
+{
+  return mctsAngles.size() * mctsMomenta.size() * (sizeof(mctsSpecialTicks) / sizeof(mctsSpecialTicks[0]));
+}
+
+/* Key of firing the loaded bird from the current world: the level and incremental world keys mixed with the shot, */
+/* the scalars and per bird arrays a shot depends on or touches for every bird, and the bird physics_engine */
+/* moves on the first tick, which is still the previous one (prior) */
+uint64_t shotKey(int bird, int prior, float angle, float momentum, int special)
+{
+  uint64_t key = mixBits(levelKey ^ worldKey ^ ((uint64_t)bird << 32 | (uint32_t)special));
+  key = mixBits(key ^ ((uint64_t)floatBits(angle) << 32 | floatBits(momentum)));
+  key = mixBits(key ^ floatBits(restore) ^ (uint64_t)deterministicPhysics << 32);
+  key = mixBits(key ^ hashBytes(2166136261u, birdSpecial, sizeof(birdSpecial)));
+  key = mixBits(key ^ hashBytes(hashBytes(hashBytes(2166136261u, birdStatus, sizeof(birdStatus)), birdSize, sizeof(birdSize)), birdTime, sizeof(birdTime)));
+  key = mixBits(key ^ ((uint64_t)prior << 32 | floatBits(birdSize[prior])));
+  key = mixBits(key ^ ((uint64_t)floatBits(birdDisplaceX[prior]) << 32 | floatBits(birdDisplaceY[prior])));
+  key = mixBits(key ^ ((uint64_t)floatBits(bird_storeX[prior]) << 32 | floatBits(bird_storeY[prior])));
+  return mixBits(key ^ hashBytes(2166136261u, &physics, sizeof(physics)));
+}
+
+void syncShotFlight(int bird, ShotFlight &flight, bool save)
+{
+  syncWorldField(birdDisplaceX[bird], flight.birdDisplaceX, save);
+  syncWorldField(birdDisplaceY[bird], flight.birdDisplaceY, save);
+  syncWorldField(phy_x[bird], flight.phy_x, save);
+  syncWorldField(phy_y[bird], flight.phy_y, save);
+  syncWorldField(bird_storeX[bird], flight.bird_storeX, save);
+  syncWorldField(bird_storeY[bird], flight.bird_storeY, save);
+}
+
+/* Copies the fields a shot changes to the outcome or back, positions of the other birds are left alone */
+void syncShotOutcome(ShotOutcome &outcome, bool save)
+{
+  syncShotFlight(outcome.prior, outcome.flights[0], save);
+  syncShotFlight(outcome.bird, outcome.flights[1], save);
+  syncWorldField(birdStatus, outcome.birdStatus, save);
+  syncWorldField(birdSize, outcome.birdSize, save);
+  syncWorldField(birdTime, outcome.birdTime, save);
+  syncWorldField(birdSpecial, outcome.birdSpecial, save);
+  syncWorldField(restore, outcome.restore, save);
+  syncWorldField(score, outcome.score, save);
+  syncWorldField(over, outcome.over, save);
+  syncWorldField(canonMomentum, outcome.canonMomentum, save);
+  syncWorldField(canon_tunnel_rotation, outcome.canon_tunnel_rotation, save);
+  syncWorldField(canon_tunnel_angle, outcome.canon_tunnel_angle, save);
+  syncWorldField(phy_ux, outcome.phy_ux, save);
+  syncWorldField(phy_uy, outcome.phy_uy, save);
+  syncWorldField(phy_vy, outcome.phy_vy, save);
+  syncWorldField(phy_time, outcome.phy_time, save);
+  syncWorldField(phy_angle, outcome.phy_angle, save);
+  syncWorldField(phy_index, outcome.phy_index, save);
+  syncWorldField(phy_start, outcome.phy_start, save);
+  syncWorldField(worldKey, outcome.worldKey, save);
+}
+
+/* Shared by every worker forked after it, so one worker's shots answer the others' */
+bool createShotCache()
+{
+  size_t slotBytes = (sizeof(ShotCacheSlot) + sizeof(ShotOutcome) + levelStateBytes + 7) & ~(size_t)7;
+  size_t slots = max((size_t)1, (SHOT_CACHE_BYTES - sizeof(ShotCacheHeader)) / slotBytes);
+  void *data = mmap(NULL, sizeof(ShotCacheHeader) + slots * slotBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(data == MAP_FAILED)
+    return false;
+  shotCache = (ShotCacheHeader *)data;
+  shotCache->slots = slots;
+  shotCache->slotBytes = slotBytes;
+  shotCacheWorld.resize(sizeof(ShotOutcome) + levelStateBytes);
+  return true;
+}
+
+ShotCacheSlot *shotCacheSlot(uint64_t key)
+{
+  return (ShotCacheSlot *)((char *)(shotCache + 1) + (key % shotCache->slots) * shotCache->slotBytes);
+}
+
+/* Puts the outcome of the cached shot in place, fails when the slot holds another key or is being written, */
+/* or an outcome of another level, bird or prior bird under a colliding key */
+bool lookupShot(uint64_t key, int bird, int prior)
+{
+  ShotCacheSlot *slot = shotCacheSlot(key);
+  uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+  bool found = false;
+  int32_t ticks = 0;
+  if(sequence && !(sequence & 1) && __atomic_load_n(&slot->key, __ATOMIC_RELAXED) == key)
+  {
+    ticks = __atomic_load_n(&slot->ticks, __ATOMIC_RELAXED);
+    memcpy(shotCacheWorld.data(), slot + 1, shotCacheWorld.size());
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    found = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence;
+  }
+  ShotOutcome outcome;
+  memcpy(&outcome, shotCacheWorld.data(), sizeof(outcome));
+  found = found && outcome.levelKey == levelKey && outcome.bird == bird && outcome.prior == prior;
+  __atomic_add_fetch(found ? &shotCache->hits : &shotCache->misses, 1, __ATOMIC_RELAXED);
+  if(!found)
+    return false;
+  syncShotOutcome(outcome, false);
+  memcpy(levelState, shotCacheWorld.data() + sizeof(outcome), levelStateBytes);
+  sim_tick += ticks;
+  return true;
+}
+
+/* Replaces whatever the slot held, a slot another worker is writing is left to that worker */
+void storeShot(uint64_t key, int32_t ticks, int bird, int prior)
+{
+  ShotCacheSlot *slot = shotCacheSlot(key);
+  uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+  if((sequence & 1) || !__atomic_compare_exchange_n(&slot->sequence, &sequence, sequence + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  ShotOutcome outcome;
+  memset(&outcome, 0, sizeof(outcome));
+  outcome.levelKey = levelKey;
+  outcome.bird = bird;
+  outcome.prior = prior;
+  syncShotOutcome(outcome, true);
+  memcpy(shotCacheWorld.data(), &outcome, sizeof(outcome));
+  memcpy(shotCacheWorld.data() + sizeof(outcome), levelState, levelStateBytes);
+  __atomic_store_n(&slot->key, key, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->ticks, ticks, __ATOMIC_RELAXED);
+  memcpy(slot + 1, shotCacheWorld.data(), shotCacheWorld.size());
+  __atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&shotCache->stores, 1, __ATOMIC_RELAXED);
+}
+
+void reportShotCache(const char *tool)
+{
+  if(!shotCache)
+    return;
+  unsigned long hits = shotCache->hits, misses = shotCache->misses;
+  printf("%s: shot cache %lu hits, %lu misses (%.1f%%), %lu slots\n", tool, hits, misses, hits + misses ? 100.0 * hits / (hits + misses) : 0.0, (unsigned long)shotCache->slots);
+}
+
+/* Fires the loaded bird, presses P special ticks into the flight (never when negative) and runs until it comes to rest */
+/* With the shot cache on, a shot already played from the same world is not simulated again */
+void playShot(float angle, float momentum, int special)
+{
+  int bird = loadedBird();
+  int prior = phy_index;
+  uint64_t key = 0;
+  if(shotCache)
+  {
+    key = shotKey(bird, prior, angle, momentum, special);
+    if(lookupShot(key, bird, prior))
+      return;
+  }
+  uint32_t start = sim_tick;
+  fireBird(angle, momentum);
+  for (int t = 0; t < SOLVER_VERIFY_TICKS && birdStatus[bird] == 1; t++)
+  {
+    if(t == special)
+    {
+      InputEvent power = {sim_tick, GLFW_KEY_P, GLFW_PRESS};
+      applyInput(power);
+    }
+    simulate();
+  }
+  if(shotCache)
+    storeShot(key, sim_tick - start, bird, prior);
+}
+
+void playAction(int action)
+{
+  int specials = sizeof(mctsSpecialTicks) / sizeof(mctsSpecialTicks[0]);
+  int special = mctsSpecialTicks[action % specials];
+  action /= specials;
+  playShot(mctsAngles[action / mctsMomenta.size()], mctsMomenta[action % mctsMomenta.size()], special);
+}
+
+int addMctsNode(std::vector<MctsNode> &tree, int parent, int action, uint64_t &rng)
+{
+  MctsNode node;
+  node.parent = parent;
+  node.action = action;
+  saveWorld(node.world);
+  node.visits = 0;
+  node.reward = 0;
+  node.terminal = loadedBird() < 0;
+  if(!node.terminal)
+  {
+    node.untried.resize(mctsActionCount());
+    for (size_t i = 0; i < node.untried.size(); i++)
+      node.untried[i] = i;
+    // Shuffled once, expansion then just pops the next untried action
+    for (size_t i = node.untried.size() - 1; i > 0; i--)
+      swap(node.untried[i], node.untried[nextRandom(rng) % (i + 1)]);
+  }
+  tree.push_back(node);
+  if(parent >= 0)
+    tree[parent].children.push_back(tree.size() - 1);
+  return tree.size() - 1;
+}
+
+/* One search worker: UCT over shots and special timings, random playouts to the last bird */
+void mctsWorker(int worker, FILE *out)
+{
+  uint64_t rng = 0x5EED0000ull + worker;
+  double maxScore = max(1, 10 * numOfPiggy + 5 * numOfIce);
+  std::vector<MctsNode> tree;
+  addMctsNode(tree, -1, -1, rng);
+  MctsResult result;
+  memset(&result, 0, sizeof(result));
+  result.bestScore = -1;
+  std::vector<int> sequence;
+  chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(mctsBudget));
+  while(chrono::steady_clock::now() < deadline)
+  {
+    // Selection, down fully expanded nodes by UCT
+    int node = 0;
+    while(!tree[node].terminal && tree[node].untried.empty())
+    {
+      double logVisits = log((double)tree[node].visits);
+      int best = tree[node].children[0];
+      double bestValue = -1;
+      for (size_t c = 0; c < tree[node].children.size(); c++)
+      {
+        const MctsNode &child = tree[tree[node].children[c]];
+        double value = child.reward / child.visits + MCTS_EXPLORATION * sqrt(logVisits / child.visits);
+        if(value > bestValue)
+        {
+          bestValue = value;
+          best = tree[node].children[c];
+        }
+      }
+      node = best;
+    }
+    restoreWorld(tree[node].world);
+    // Expansion, one new child from the node's own world
+    if(!tree[node].terminal)
+    {
+      int action = tree[node].untried.back();
+      tree[node].untried.pop_back();
+      playAction(action);
+      node = addMctsNode(tree, node, action, rng);
+    }
+    sequence.clear();
+    for (int n = node; tree[n].parent >= 0; n = tree[n].parent)
+      sequence.insert(sequence.begin(), tree[n].action);
+    // Playout, random actions until no bird is left
+    while(loadedBird() >= 0 && sequence.size() < 10)
+    {
+      int action = nextRandom(rng) % mctsActionCount();
+      playAction(action);
+      sequence.push_back(action);
+    }
+    if(score > result.bestScore)
+    {
+      result.bestScore = score;
+      result.bestLength = sequence.size();
+      copy(sequence.begin(), sequence.end(), result.bestActions);
+    }
+    for (int n = node; n >= 0; n = tree[n].parent)
+    {
+      tree[n].visits++;
+      tree[n].reward += score / maxScore;
+    }
+    result.iterations++;
+  }
+  fwrite(&result, sizeof(result), 1, out);
+  for (size_t c = 0; c < tree[0].children.size(); c++)
+  {
+    const MctsNode &child = tree[tree[0].children[c]];
+    int32_t stats[2] = {child.action, child.visits};
+    double reward = child.reward;
+    fwrite(stats, sizeof(stats), 1, out);
+    fwrite(&reward, sizeof(reward), 1, out);
+  }
+}
+
+void printMctsAction(int action)
+{
+  int specials = sizeof(mctsSpecialTicks) / sizeof(mctsSpecialTicks[0]);
+  int special = mctsSpecialTicks[action % specials];
+  action /= specials;
+  printf("angle %.2f momentum %.0f ", mctsAngles[action / mctsMomenta.size()], mctsMomenta[action % mctsMomenta.size()]);
+  if(special < 0)
+    printf("no special");
+  else
+    printf("special after %d ticks", special);
+}
+
+/* --mcts, root parallel search: every worker grows its own tree, the roots are merged at the end */
+int reportMcts(double seconds)
+{
+  if(loadedBird() < 0)
+  {
+    printf("mcts: no bird left to fire\n");
+    return EXIT_FAILURE;
+  }
+  buildShotGrid();
+  suppressReplay();
+  mctsBudget = seconds;
+  createShotCache();
+
+  int workers = max(1, (int)thread::hardware_concurrency());
+  std::vector<std::string> outputs;
+  forkWorkers(workers, mctsWorker, outputs);
+
+  MctsResult best;
+  best.bestScore = -1;
+  unsigned long iterations = 0;
+  int answered = 0;
+  std::vector<int> visits(mctsActionCount(), 0);
+  std::vector<double> rewards(mctsActionCount(), 0);
+  for (int w = 0; w < workers; w++)
+  {
+    if(outputs[w].size() < sizeof(MctsResult))
+      continue;
+    MctsResult result;
+    memcpy(&result, outputs[w].data(), sizeof(result));
+    answered++;
+    iterations += result.iterations;
+    if(result.bestScore > best.bestScore)
+      best = result;
+    const size_t entry = 2 * sizeof(int32_t) + sizeof(double);
+    for (size_t offset = sizeof(result); offset + entry <= outputs[w].size(); offset += entry)
+    {
+      int32_t stats[2];
+      double reward;
+      memcpy(stats, outputs[w].data() + offset, sizeof(stats));
+      memcpy(&reward, outputs[w].data() + offset + sizeof(stats), sizeof(reward));
+      visits[stats[0]] += stats[1];
+      rewards[stats[0]] += reward;
+    }
+  }
+  if(!answered)
+  {
+    printf("mcts: every worker failed\n");
+    return EXIT_FAILURE;
+  }
+  printf("mcts: %d workers, %.1f s, %lu playouts (%.0f/s)\n", answered, seconds, iterations, iterations / seconds);
+  printf("mcts: best score %d\n", best.bestScore);
+  reportShotCache("mcts");
+  for (int b = 0; b < best.bestLength; b++)
+  {
+    printf("mcts:   bird %d: ", b);
+    printMctsAction(best.bestActions[b]);
+    printf("\n");
+  }
+  int first = max_element(visits.begin(), visits.end()) - visits.begin();
+  printf("mcts: most visited first shot: ");
+  printMctsAction(first);
+  printf(", %d visits, mean reward %.2f\n", visits[first], visits[first] ? rewards[first] / visits[first] : 0.0);
+  return EXIT_SUCCESS;
+}
+
+/* Shots from outside the game are held to what the canon can do, NaN included */
+float clampAngle(float angle)
+{
+  return angle >= 0 ? min(angle, (float)(M_PI/3)) : 0.0f;
+}
+
+float clampMomentum(float momentum)
+{
+  return momentum >= CANON_MIN_MOM ? min(momentum, CANON_MAX_MOM) : CANON_MIN_MOM;
+}
+
+/* Observation of the world currently loaded, written into the instance's slots */
+void writeEnvObservation(int instance, float reward)
+{
+  EnvHeader *header = envShared;
+  int bird = loadedBird();
+  envArray<int32_t>(header, header->bird)[instance] = bird;
+  envArray<int32_t>(header, header->score)[instance] = score;
+  envArray<float>(header, header->reward)[instance] = reward;
+  envArray<uint8_t>(header, header->done)[instance] = bird < 0;
+  uint8_t *ice = envArray<uint8_t>(header, header->iceStatus) + (size_t)instance * numOfIce;
+  for (int i = 0; i < numOfIce; i++)
+    ice[i] = iceBroken[i];
+  uint8_t *piggy = envArray<uint8_t>(header, header->piggyStatus) + (size_t)instance * numOfPiggy;
+  for (int i = 0; i < numOfPiggy; i++)
+    piggy[i] = piggyHurt[i];
+}
+
+/* A trainer that was killed never sends ENV_CLOSE, nor does a game that was, workers check for both */
+bool envPeersAlive(EnvHeader *header, pid_t game)
+{
+  pid_t trainer = envLoad(&header->trainer);
+  if(trainer > 0 && kill(trainer, 0) != 0 && errno == ESRCH)
+    return false;
+  return getppid() == game;
+}
+
+/* SIGINT or SIGTERM while serving, the shared memory object must not outlive the game */
+void envSignal(int signal)
+{
+  if(envPath)
+    shm_unlink(envPath);
+  _exit(128 + signal);
+}
+
+/* One environment worker hosts every instance whose index modulo the worker count is its own, */
+/* switching between their world blobs, and steps them all each time the trainer bumps the sequence. */
+/* On ENV_CLOSE it reports how many shots it played */
+void envWorker(int worker, FILE *out)
+{
+  EnvHeader *header = envShared;
+  int workers = header->numWorkers;
+  std::vector<std::vector<char> > worlds;
+  for (uint32_t i = worker; i < header->numInstances; i += workers)
+    worlds.push_back(levelStart);
+  const float *angles = envArray<float>(header, header->actionAngle);
+  const float *momenta = envArray<float>(header, header->actionMomentum);
+  const int32_t *specials = envArray<int32_t>(header, header->actionSpecial);
+  pid_t game = getppid();
+  envAdd(&header->ready, 1);
+  uint32_t seen = 0;
+  uint64_t shots = 0;
+  for (;;)
+  {
+    uint32_t sequence;
+    // Spin while steps come back to back, back off once the trainer is busy elsewhere
+    bool alive = true;
+    for (int spins = 0; alive && (sequence = envLoad(&header->sequence)) == seen; spins++)
+    {
+      if(spins < ENV_SPINS)
+        this_thread::yield();
+      else
+        usleep(ENV_BACKOFF_US);
+      if(spins >= ENV_SPINS && (spins - ENV_SPINS) % ENV_LIVENESS_BACKOFFS == ENV_LIVENESS_BACKOFFS - 1)
+        alive = envPeersAlive(header, game);
+    }
+    if(!alive)
+      break;
+    seen = sequence;
+    uint32_t command = header->command;
+    if(command == ENV_CLOSE)
+      break;
+    for (size_t k = 0; k < worlds.size(); k++)
+    {
+      int instance = worker + k * workers;
+      float reward = 0;
+      if(command == ENV_RESET)
+        worlds[k] = levelStart;
+      restoreWorld(worlds[k]);
+      if(command == ENV_STEP && loadedBird() >= 0)
+      {
+        int before = score;
+        playShot(clampAngle(angles[instance]), clampMomentum(momenta[instance]), specials[instance]);
+        reward = score - before;
+        saveWorld(worlds[k]);
+        shots++;
+      }
+      writeEnvObservation(instance, reward);
+    }
+    envAdd(&header->finished, 1);
+  }
+  fwrite(&shots, sizeof(shots), 1, out);
+}
+
+/* --env, creates the shared memory and serves the environment until the trainer sends ENV_CLOSE */
+int serveEnvironment(const char *name, int instances)
+{
+  EnvHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ENV_MAGIC, 4);
+  header.version = ENV_VERSION;
+  header.numInstances = instances;
+  header.numWorkers = max(1, min(instances, (int)thread::hardware_concurrency()));
+  header.numIce = numOfIce;
+  header.numPiggy = numOfPiggy;
+  uint64_t size = envLayout(header);
+  std::string path = name[0] == '/' ? name : std::string("/") + name;
+  int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if(fd < 0)
+  {
+    printf("env: could not create shared memory `%s'\n", path.c_str());
+    return EXIT_FAILURE;
+  }
+  void *data = ftruncate(fd, size) == 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if(data == MAP_FAILED)
+  {
+    shm_unlink(path.c_str());
+    printf("env: could not map %lu bytes of shared memory\n", (unsigned long)size);
+    return EXIT_FAILURE;
+  }
+  envShared = (EnvHeader *)data;
+  memcpy(envShared, &header, sizeof(header));
+  suppressReplay();
+  printf("env: %s, %d instances on %u workers, %lu bytes\n", path.c_str(), instances, header.numWorkers, (unsigned long)size);
+  createShotCache();
+  envPath = path.c_str();
+  signal(SIGINT, envSignal);
+  signal(SIGTERM, envSignal);
+
+  std::vector<std::string> outputs;
+  forkWorkers(header.numWorkers, envWorker, outputs);
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  envPath = NULL;
+  if(envShared->command != ENV_CLOSE)
+    printf("env: trainer %u went away without closing the environment\n", envLoad(&envShared->trainer));
+  munmap(data, size);
+  shm_unlink(path.c_str());
+  uint64_t shots = 0;
+  int answered = 0;
+  for (size_t w = 0; w < outputs.size(); w++)
+  {
+    if(outputs[w].size() != sizeof(uint64_t))
+      continue;
+    uint64_t part;
+    memcpy(&part, outputs[w].data(), sizeof(part));
+    shots += part;
+    answered++;
+  }
+  printf("env: %lu shots played, %d of %u workers answered\n", (unsigned long)shots, answered, header.numWorkers);
+  reportShotCache("env");
+  return EXIT_SUCCESS;
+}
+
+double getPhysicsParameter(const PhysicsConfig &config, int parameter)
+{
+  switch(parameter)
+  {
+    case PHYSICS_GRAVITY: return config.gravity;
+    case PHYSICS_GROUND_REBOUND: return config.groundRebound;
+    case PHYSICS_TIME_REFERENCE: return config.timeReference;
+    case PHYSICS_VELOCITY_MIN: return config.velocityMin;
+    default: return config.breakMin;
+  }
+}
+
+void setPhysicsParameter(PhysicsConfig &config, int parameter, double value)
+{
+  switch(parameter)
+  {
+    case PHYSICS_GRAVITY: config.gravity = value; break;
+    case PHYSICS_GROUND_REBOUND: config.groundRebound = value; break;
+    case PHYSICS_TIME_REFERENCE: config.timeReference = value; break;
+    case PHYSICS_VELOCITY_MIN: config.velocityMin = value; break;
+    default: config.breakMin = value; break;
+  }
+}
+
+/* --physics name=value,..., unknown names and values the simulation can not run with are rejected */
+bool parsePhysics(const char *spec, PhysicsConfig &config)
+{
+  std::string rest = spec;
+  while(!rest.empty())
+  {
+    size_t comma = rest.find(',');
+    std::string item = rest.substr(0, comma);
+    rest = comma == std::string::npos ? "" : rest.substr(comma + 1);
+    size_t equals = item.find('=');
+    if(equals == std::string::npos)
+      return false;
+    int parameter = 0;
+    while(parameter < PHYSICS_PARAMETER_COUNT && item.compare(0, equals, physicsNames[parameter]))
+      parameter++;
+    char *end;
+    double value = strtod(item.c_str() + equals + 1, &end);
+    if(parameter == PHYSICS_PARAMETER_COUNT || *end || !(value >= 0))
+      return false;
+    if((parameter == PHYSICS_GRAVITY || parameter == PHYSICS_TIME_REFERENCE) && value <= 0)
+      return false;
+    setPhysicsParameter(config, parameter, value);
+  }
+  return true;
+}
+
+/* Sweep job j scales parameter j / (factors * shots) by factor (j / shots) % factors and fires shot j % shots */
+int sweepShots()
+{
+  return mctsAngles.size() * mctsMomenta.size();
+}
+
+/* Each worker takes every workers-th job, fires it from the start of the level and reports the score and flight ticks */
+void sweepWorker(int worker, FILE *out)
+{
+  int workers = max(1, (int)thread::hardware_concurrency());
+  int shots = sweepShots();
+  int jobs = PHYSICS_PARAMETER_COUNT * SWEEP_FACTOR_COUNT * shots;
+  PhysicsConfig base = physics;
+  for (int job = worker; job < jobs; job += workers)
+  {
+    int shot = job % shots;
+    int combination = job / shots;
+    restoreWorld(levelStart);
+    physics = base;
+    setPhysicsParameter(physics, combination / SWEEP_FACTOR_COUNT, getPhysicsParameter(base, combination / SWEEP_FACTOR_COUNT) * sweepFactors[combination % SWEEP_FACTOR_COUNT]);
+    uint32_t start = sim_tick;
+    playShot(mctsAngles[shot / mctsMomenta.size()], mctsMomenta[shot % mctsMomenta.size()], -1);
+    SweepResult result = {job, score, (int32_t)(sim_tick - start)};
+    fwrite(&result, sizeof(result), 1, out);
+  }
+}
+
+/* --sweep, one table per parameter: how the score and flight length of the first bird move with it */
+int reportSweep(const char *path)
+{
+  if(loadedBird() < 0)
+  {
+    printf("sweep: no bird left to fire\n");
+    return EXIT_FAILURE;
+  }
+  buildShotGrid();
+  suppressReplay();
+  createShotCache();
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  int workers = max(1, (int)thread::hardware_concurrency());
+  std::vector<std::string> outputs;
+  forkWorkers(workers, sweepWorker, outputs);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  int shots = sweepShots();
+  int combinations = PHYSICS_PARAMETER_COUNT * SWEEP_FACTOR_COUNT;
+  std::vector<SweepResult> results(combinations * shots);
+  std::vector<bool> seen(results.size(), false);
+  size_t received = 0;
+  for (int w = 0; w < workers; w++)
+    for (size_t offset = 0; offset + sizeof(SweepResult) <= outputs[w].size(); offset += sizeof(SweepResult))
+    {
+      SweepResult result;
+      memcpy(&result, outputs[w].data() + offset, sizeof(result));
+      if(result.job < 0 || result.job >= (int)results.size() || seen[result.job])
+        continue;
+      results[result.job] = result;
+      seen[result.job] = true;
+      received++;
+    }
+  if(received != results.size())
+  {
+    printf("sweep: only %lu of %lu shots came back\n", (unsigned long)received, (unsigned long)results.size());
+    return EXIT_FAILURE;
+  }
+
+  FILE *out = fopen(path, "w");
+  if(!out)
+  {
+    printf("sweep: could not write `%s'\n", path);
+    return EXIT_FAILURE;
+  }
+  fprintf(out, "# %d shots per row, first bird from the start of the level, score and ticks until it came to rest\n", shots);
+  for (int parameter = 0; parameter < PHYSICS_PARAMETER_COUNT; parameter++)
+  {
+    fprintf(out, "\n# %s\nfactor\tvalue\tmean_score\tbest_score\tscoring_shots\tmean_ticks\tmax_ticks\n", physicsNames[parameter]);
+    double lowest = 1e30, highest = -1e30;
+    for (int f = 0; f < SWEEP_FACTOR_COUNT; f++)
+    {
+      const SweepResult *row = &results[(parameter * SWEEP_FACTOR_COUNT + f) * shots];
+      double totalScore = 0, totalTicks = 0;
+      int best = 0, scoring = 0, longest = 0;
+      for (int shot = 0; shot < shots; shot++)
+      {
+        totalScore += row[shot].score;
+        totalTicks += row[shot].ticks;
+        best = max(best, (int)row[shot].score);
+        scoring += row[shot].score > 0;
+        longest = max(longest, (int)row[shot].ticks);
+      }
+      fprintf(out, "%.2f\t%g\t%.2f\t%d\t%d\t%.1f\t%d\n", sweepFactors[f], getPhysicsParameter(physics, parameter) * sweepFactors[f], totalScore / shots, best, scoring, totalTicks / shots, longest);
+      lowest = min(lowest, totalScore / shots);
+      highest = max(highest, totalScore / shots);
+    }
+    printf("sweep: %-12s mean score %.2f to %.2f\n", physicsNames[parameter], lowest, highest);
+  }
+  fclose(out);
+  printf("sweep: %lu shots on %d workers in %.2f s, tables in %s\n", (unsigned long)results.size(), workers, seconds, path);
+  reportShotCache("sweep");
+  return EXIT_SUCCESS;
+}
+
+/* Sample s opens with grid action s % actions, so the first shots walk the whole grid in order and the */
+/* split depends only on estimateWorkers. The later birds fire actions drawn from a stream seeded by s */
+void estimateWorker(int worker, FILE *out)
+{
+  int specials = sizeof(mctsSpecialTicks) / sizeof(mctsSpecialTicks[0]);
+  int actions = mctsActionCount();
+  std::vector<EstimateCell> cells(mctsAngles.size() * mctsMomenta.size());
+  memset(cells.data(), 0, cells.size() * sizeof(EstimateCell));
+  for (long sample = worker; sample < estimateSamples; sample += estimateWorkers)
+  {
+    uint64_t rng = 0xE571A7E0ull + sample;
+    int first = sample % actions;
+    restoreWorld(levelStart);
+    playAction(first);
+    for (int shots = 1; shots < LEVEL_MAX_BIRDS && loadedBird() >= 0; shots++)
+      playAction(nextRandom(rng) % actions);
+    int shot = first / specials;
+    int cell = shot % mctsMomenta.size() * mctsAngles.size() + shot / mctsMomenta.size();
+    cells[cell].samples++;
+    cells[cell].wins += score >= WIN_SCORE;
+    cells[cell].totalScore += score;
+    cells[cell].bestScore = max(cells[cell].bestScore, (int32_t)score);
+  }
+  fwrite(cells.data(), sizeof(EstimateCell), cells.size(), out);
+}
+
+/* Heatmap over the first shot, angle grows to the right and momentum upwards. Red is the mean score */
+/* against the best cell, green the share of wins, cells nobody sampled stay dark blue */
+bool writeEstimateHeatmap(const char *path, const std::vector<EstimateCell> &cells)
+{
+  double bestMean = 0;
+  for (size_t c = 0; c < cells.size(); c++)
+    if(cells[c].samples)
+      bestMean = max(bestMean, cells[c].totalScore / cells[c].samples);
+  int angles = mctsAngles.size(), momenta = mctsMomenta.size();
+  int width = angles * ESTIMATE_CELL_PIXELS, height = momenta * ESTIMATE_CELL_PIXELS;
+  std::vector<unsigned char> pixels(3 * width * height);
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+    {
+      const EstimateCell &cell = cells[(momenta - 1 - y / ESTIMATE_CELL_PIXELS) * angles + x / ESTIMATE_CELL_PIXELS];
+      unsigned char *pixel = &pixels[3 * (y * width + x)];
+      pixel[0] = cell.samples && bestMean > 0 ? (unsigned char)(255 * cell.totalScore / cell.samples / bestMean) : 0;
+      pixel[1] = cell.samples ? (unsigned char)(255 * cell.wins / cell.samples) : 0;
+      pixel[2] = cell.samples ? 0 : 64;
+    }
+  FILE *out = fopen(path, "wb");
+  if(!out)
+    return false;
+  fprintf(out, "P6\n%d %d\n255\n", width, height);
+  bool written = fwrite(pixels.data(), 1, pixels.size(), out) == pixels.size();
+  return fclose(out) == 0 && written;
+}
+
+/* --estimate, how often sequences over the shot grid win the level and where the first shots that win lie */
+int reportEstimate(const char *path)
+{
+  if(loadedBird() < 0)
+  {
+    printf("estimate: no bird left to fire\n");
+    return EXIT_FAILURE;
+  }
+  buildShotGrid();
+  suppressReplay();
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  int workers = estimateWorkers = max(1, (int)thread::hardware_concurrency());
+  std::vector<std::string> outputs;
+  forkWorkers(workers, estimateWorker, outputs);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  std::vector<EstimateCell> cells(mctsAngles.size() * mctsMomenta.size());
+  memset(cells.data(), 0, cells.size() * sizeof(EstimateCell));
+  int answered = 0;
+  for (int w = 0; w < workers; w++)
+  {
+    if(outputs[w].size() != cells.size() * sizeof(EstimateCell))
+      continue;
+    const EstimateCell *part = (const EstimateCell *)outputs[w].data();
+    for (size_t c = 0; c < cells.size(); c++)
+    {
+      cells[c].samples += part[c].samples;
+      cells[c].wins += part[c].wins;
+      cells[c].totalScore += part[c].totalScore;
+      cells[c].bestScore = max(cells[c].bestScore, part[c].bestScore);
+    }
+    answered++;
+  }
+  if(!answered)
+  {
+    printf("estimate: every worker failed\n");
+    return EXIT_FAILURE;
+  }
+  unsigned long samples = 0, wins = 0;
+  double totalScore = 0;
+  int best = 0, bestCell = 0;
+  for (size_t c = 0; c < cells.size(); c++)
+  {
+    samples += cells[c].samples;
+    wins += cells[c].wins;
+    totalScore += cells[c].totalScore;
+    if(cells[c].bestScore > best)
+    {
+      best = cells[c].bestScore;
+      bestCell = c;
+    }
+  }
+  if(!samples)
+  {
+    printf("estimate: no sequences were played\n");
+    return EXIT_FAILURE;
+  }
+  printf("estimate: %lu sequences over %d grid actions on %d workers in %.2f s (%.0f/s)\n", samples, mctsActionCount(), answered, seconds, samples / seconds);
+  printf("estimate: %lu won (score >= %d), %.2f%%, mean score %.2f\n", wins, WIN_SCORE, 100.0 * wins / samples, totalScore / samples);
+  printf("estimate: best score %d, first shot angle %.2f, momentum %.0f\n", best,
+         mctsAngles[bestCell % mctsAngles.size()], mctsMomenta[bestCell / mctsAngles.size()]);
+  if(!writeEstimateHeatmap(path, cells))
+  {
+    printf("estimate: could not write `%s'\n", path);
+    return EXIT_FAILURE;
+  }
+  printf("estimate: heatmap in %s\n", path);
+  return EXIT_SUCCESS;
+}
+
+/* Whole frames over a stream socket, MSG_NOSIGNAL so a peer that died is an error and not SIGPIPE */
+bool sendAll(int fd, const void *data, size_t length)
+{
+  const char *bytes = (const char *)data;
+  while(length > 0)
+  {
+    ssize_t sent = send(fd, bytes, length, MSG_NOSIGNAL);
+    if(sent < 0 && errno == EINTR)
+      continue;
+    if(sent <= 0)
+      return false;
+    bytes += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+bool receiveAll(int fd, void *data, size_t length)
+{
+  char *bytes = (char *)data;
+  while(length > 0)
+  {
+    ssize_t received = recv(fd, bytes, length, 0);
+    if(received < 0 && errno == EINTR)
+      continue;
+    if(received <= 0)
+      return false;
+    bytes += received;
+    length -= received;
+  }
+  return true;
+}
+
+template <typename T> bool sendFrame(int fd, uint32_t type, const std::vector<T> &records)
+{
+  PoolFrame frame = {type, (uint32_t)records.size()};
+  return sendAll(fd, &frame, sizeof(frame)) && (records.empty() || sendAll(fd, records.data(), records.size() * sizeof(T)));
+}
+
+/* A count above limit means the peer is out of step, it fails before anything is allocated */
+template <typename T> bool receiveFrame(int fd, uint32_t &type, std::vector<T> &records, uint32_t limit)
+{
+  PoolFrame frame;
+  if(!receiveAll(fd, &frame, sizeof(frame)) || frame.count > limit)
+    return false;
+  type = frame.type;
+  records.resize(frame.count);
+  return frame.count == 0 || receiveAll(fd, records.data(), frame.count * sizeof(T));
+}
+
+/* Levels are switched between jobs: back to the scalars every level starts from, then load the next one */
+void usePoolLevel(int level)
+{
+  WorldScalars world;
+  memcpy(&world, levelStart.data(), sizeof(world));
+  syncWorldScalars(world, false);
+  numOfBirds = 0;
+  levelPath = poolLevels[level].empty() ? NULL : poolLevels[level].c_str();
+  initLevel();
+  poolLevel = level;
+}
+
+/* Worker side: answers every batch of jobs with a batch of results until told to quit or the coordinator goes away */
+/* Grid actions for --pool, free form shots for --serve */
+void poolWorker(int fd)
+{
+  PoolFrame frame;
+  std::vector<PoolJob> jobs;
+  std::vector<PoolResult> results;
+  std::vector<PoolShot> shots;
+  std::vector<PoolShotResult> outcomes;
+  // Coordinators never send more than POOL_BATCH records at once
+  while(receiveAll(fd, &frame, sizeof(frame)) && frame.count <= POOL_BATCH)
+  {
+    if(frame.type == POOL_JOBS)
+    {
+      jobs.resize(frame.count);
+      if(!receiveAll(fd, jobs.data(), jobs.size() * sizeof(PoolJob)))
+        break;
+      results.clear();
+      for (size_t j = 0; j < jobs.size(); j++)
+      {
+        if(jobs[j].level != poolLevel)
+          usePoolLevel(jobs[j].level);
+        restoreWorld(levelStart);
+        uint32_t start = sim_tick;
+        playAction(jobs[j].action);
+        PoolResult result = {jobs[j].id, score, (int32_t)(sim_tick - start)};
+        results.push_back(result);
+      }
+      if(!sendFrame(fd, POOL_RESULTS, results))
+        break;
+    }
+    else if(frame.type == POOL_SHOTS)
+    {
+      shots.resize(frame.count);
+      if(!receiveAll(fd, shots.data(), shots.size() * sizeof(PoolShot)))
+        break;
+      outcomes.clear();
+      for (size_t j = 0; j < shots.size(); j++)
+      {
+        const ServeShot &shot = shots[j].shot;
+        if(shot.level != poolLevel)
+          usePoolLevel(shot.level);
+        restoreWorld(levelStart);
+        uint32_t start = sim_tick;
+        playShot(clampAngle(shot.angle), clampMomentum(shot.momentum), shot.special);
+        PoolShotResult outcome = {shots[j].request, shots[j].index, {score, (int32_t)(sim_tick - start)}};
+        outcomes.push_back(outcome);
+      }
+      if(!sendFrame(fd, POOL_OUTCOMES, outcomes))
+        break;
+    }
+    else
+      break;
+  }
+}
+
+/* Forks a worker connected by its own socket pair, the child drops every other worker's socket and the inherited ones */
+bool spawnPoolWorker(std::vector<PoolWorker> &workers, int index, const std::vector<int> &inherited = std::vector<int>())
+{
+  int ends[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0)
+    return false;
+  fflush(stdout);
+  pid_t pid = fork();
+  if(pid == 0)
+  {
+    close(ends[0]);
+    for (size_t w = 0; w < workers.size(); w++)
+      if(workers[w].fd >= 0)
+        close(workers[w].fd);
+    for (size_t f = 0; f < inherited.size(); f++)
+      close(inherited[f]);
+    poolWorker(ends[1]);
+    _exit(EXIT_SUCCESS);
+  }
+  close(ends[1]);
+  if(pid < 0)
+  {
+    close(ends[0]);
+    return false;
+  }
+  workers[index].pid = pid;
+  workers[index].fd = ends[0];
+  workers[index].batch.clear();
+  return true;
+}
+
+/* Hands the worker the next batch, jobs of one level stay together because the queue is in level order */
+void sendPoolBatch(PoolWorker &worker, std::deque<PoolJob> &queue)
+{
+  worker.batch.clear();
+  while(!queue.empty() && worker.batch.size() < POOL_BATCH)
+  {
+    worker.batch.push_back(queue.front());
+    queue.pop_front();
+  }
+  // A failed send shows up as a hang up in the poll loop and the batch is queued again
+  if(!worker.batch.empty())
+    sendFrame(worker.fd, POOL_JOBS, worker.batch);
+}
+
+/* --pool, every shot of the action grid on every level, farmed out to forked workers over Unix sockets. */
+/* A worker that dies is replaced and its batch queued again, a job that kills POOL_MAX_ATTEMPTS workers is dropped */
+int reportPool(const char *path, int numWorkers)
+{
+  if(poolLevels.empty())
+    poolLevels.push_back(levelPath ? levelPath : "");
+  if(poolLevels.size() > 65535)
+  {
+    printf("pool: at most 65535 levels\n");
+    return EXIT_FAILURE;
+  }
+  buildShotGrid();
+  suppressReplay();
+  // Every level is loaded once up front, so a broken one stops the run here instead of killing workers
+  for (size_t l = 0; l < poolLevels.size(); l++)
+    usePoolLevel(l);
+
+  std::deque<PoolJob> queue;
+  for (size_t l = 0; l < poolLevels.size(); l++)
+    for (int a = 0; a < mctsActionCount(); a++)
+    {
+      PoolJob job = {(uint32_t)queue.size(), (uint16_t)l, (uint16_t)a};
+      queue.push_back(job);
+    }
+  std::vector<PoolJob> jobs(queue.begin(), queue.end());
+  std::vector<PoolResult> results(jobs.size());
+  std::vector<int> attempts(jobs.size(), 0);
+  std::vector<bool> finished(jobs.size(), false);
+  size_t remaining = jobs.size();
+  int restarts = 0, dropped = 0;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  std::vector<PoolWorker> workers(numWorkers);
+  for (int w = 0; w < numWorkers; w++)
+    workers[w].fd = -1;
+  for (int w = 0; w < numWorkers; w++)
+  {
+    if(!spawnPoolWorker(workers, w))
+    {
+      printf("pool: could not start worker %d\n", w);
+      return EXIT_FAILURE;
+    }
+    sendPoolBatch(workers[w], queue);
+  }
+
+  std::vector<struct pollfd> fds(numWorkers);
+  std::vector<PoolResult> batch;
+  while(remaining > 0)
+  {
+    for (int w = 0; w < numWorkers; w++)
+    {
+      fds[w].fd = workers[w].batch.empty() ? -1 : workers[w].fd;
+      fds[w].events = POLLIN;
+      fds[w].revents = 0;
+    }
+    if(poll(fds.data(), numWorkers, -1) < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      break;
+    }
+    for (int w = 0; w < numWorkers; w++)
+    {
+      if(!fds[w].revents)
+        continue;
+      PoolWorker &worker = workers[w];
+      uint32_t type;
+      if(receiveFrame(worker.fd, type, batch, POOL_BATCH) && type == POOL_RESULTS && batch.size() == worker.batch.size())
+      {
+        for (size_t r = 0; r < batch.size(); r++)
+          if(batch[r].id < jobs.size() && !finished[batch[r].id])
+          {
+            results[batch[r].id] = batch[r];
+            finished[batch[r].id] = true;
+            remaining--;
+          }
+        sendPoolBatch(worker, queue);
+        continue;
+      }
+      // The worker crashed or sent garbage, retire it and run its batch again on a fresh one
+      close(worker.fd);
+      kill(worker.pid, SIGKILL);
+      waitpid(worker.pid, NULL, 0);
+      for (size_t j = worker.batch.size(); j-- > 0; )
+      {
+        uint32_t id = worker.batch[j].id;
+        if(finished[id])
+          continue;
+        if(++attempts[id] < POOL_MAX_ATTEMPTS)
+          queue.push_front(worker.batch[j]);
+        else
+        {
+          finished[id] = true;
+          results[id].id = id;
+          results[id].score = -1;
+          results[id].ticks = -1;
+          remaining--;
+          dropped++;
+        }
+      }
+      worker.fd = -1;
+      worker.batch.clear();
+      restarts++;
+      if(!spawnPoolWorker(workers, w))
+      {
+        printf("pool: could not restart worker %d\n", w);
+        return EXIT_FAILURE;
+      }
+      sendPoolBatch(workers[w], queue);
+    }
+    // Workers left idle while others crashed pick up the requeued jobs
+    for (int w = 0; w < numWorkers; w++)
+      if(workers[w].batch.empty())
+        sendPoolBatch(workers[w], queue);
+  }
+  std::vector<PoolJob> none;
+  for (int w = 0; w < numWorkers; w++)
+  {
+    sendFrame(workers[w].fd, POOL_QUIT, none);
+    close(workers[w].fd);
+    waitpid(workers[w].pid, NULL, 0);
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  if(remaining > 0)
+  {
+    printf("pool: gave up with %lu jobs left\n", (unsigned long)remaining);
+    return EXIT_FAILURE;
+  }
+
+  FILE *out = fopen(path, "w");
+  if(!out)
+  {
+    printf("pool: could not write `%s'\n", path);
+    return EXIT_FAILURE;
+  }
+  fprintf(out, "level\tangle\tmomentum\tspecial\tscore\tticks\n");
+  int specials = sizeof(mctsSpecialTicks) / sizeof(mctsSpecialTicks[0]);
+  for (size_t l = 0, j = 0; l < poolLevels.size(); l++)
+  {
+    int best = -1, scoring = 0;
+    for (int a = 0; a < mctsActionCount(); a++, j++)
+    {
+      int shot = a / specials;
+      fprintf(out, "%s\t%.2f\t%.0f\t%d\t%d\t%d\n", poolLevels[l].empty() ? "-" : poolLevels[l].c_str(), mctsAngles[shot / mctsMomenta.size()], mctsMomenta[shot % mctsMomenta.size()], mctsSpecialTicks[a % specials], results[j].score, results[j].ticks);
+      best = max(best, (int)results[j].score);
+      scoring += results[j].score > 0;
+    }
+    printf("pool: %s: best first shot %d, %d of %d shots score\n", poolLevels[l].empty() ? "built in level" : poolLevels[l].c_str(), best, scoring, mctsActionCount());
+  }
+  fclose(out);
+  printf("pool: %lu jobs on %d workers in %.2f s, %d restarts, %d jobs dropped, results in %s\n", (unsigned long)jobs.size(), numWorkers, seconds, restarts, dropped, path);
+  return EXIT_SUCCESS;
+}
+
+void recordLatency(LatencyHistogram &histogram, double micros)
+{
+  int bucket = micros <= 1 ? 0 : min(SERVE_HISTOGRAM_BUCKETS - 1, (int)ceil(SERVE_BUCKETS_PER_OCTAVE * log2(micros)));
+  histogram.counts[bucket]++;
+  histogram.total++;
+  histogram.sum += micros;
+  histogram.max = max(histogram.max, micros);
+}
+
+/* Upper bound of bucket b is 2^(b / SERVE_BUCKETS_PER_OCTAVE) microseconds, the last one takes everything above */
+double latencyBucketBound(int bucket)
+{
+  return pow(2.0, (double)bucket / SERVE_BUCKETS_PER_OCTAVE);
+}
+
+double latencyQuantile(const LatencyHistogram &histogram, double fraction)
+{
+  uint64_t seen = 0;
+  for (int b = 0; b < SERVE_HISTOGRAM_BUCKETS; b++)
+  {
+    seen += histogram.counts[b];
+    if(histogram.total && seen >= fraction * histogram.total)
+      return b == SERVE_HISTOGRAM_BUCKETS - 1 ? histogram.max : latencyBucketBound(b);
+  }
+  return 0;
+}
+
+/* Prometheus text format, cumulative buckets up to the last one used */
+void exportLatency(std::string &text, const char *name, const LatencyHistogram &histogram)
+{
+  char line[160];
+  int last = 0;
+  for (int b = 0; b < SERVE_HISTOGRAM_BUCKETS; b++)
+    if(histogram.counts[b])
+      last = b;
+  uint64_t cumulative = 0;
+  for (int b = 0; b <= last && histogram.total; b++)
+  {
+    cumulative += histogram.counts[b];
+    snprintf(line, sizeof(line), "%s_bucket{le=\"%.1f\"} %lu\n", name, latencyBucketBound(b), (unsigned long)cumulative);
+    text += line;
+  }
+  snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %lu\n%s_sum %.1f\n%s_count %lu\n", name, (unsigned long)histogram.total, name, histogram.sum, name, (unsigned long)histogram.total);
+  text += line;
+  const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  for (int q = 0; q < 4; q++)
+  {
+    snprintf(line, sizeof(line), "%s{quantile=\"%g\"} %.1f\n", name, quantiles[q], latencyQuantile(histogram, quantiles[q]));
+    text += line;
+  }
+}
+
+/* Queues a batch of the worker's level, shots of several requests go out together */
+void sendServeBatch(PoolWorker &worker, std::vector<std::deque<PoolShot> > &queues)
+{
+  std::deque<PoolShot> &queue = queues[worker.level];
+  worker.shots.clear();
+  while(!queue.empty() && worker.shots.size() < POOL_BATCH)
+  {
+    worker.shots.push_back(queue.front());
+    queue.pop_front();
+  }
+  worker.sent = chrono::steady_clock::now();
+  // A failed send shows up as a hang up in the poll loop and the batch is queued again
+  if(!worker.shots.empty())
+    sendFrame(worker.fd, POOL_SHOTS, worker.shots);
+}
+
+/* Client sockets never block the daemon: replies wait in the client's output until the socket takes them */
+template <typename T> void queueServeFrame(ServeClient &client, uint32_t type, const std::vector<T> &records)
+{
+  ServeFrame frame = {type, (uint32_t)records.size()};
+  client.output.append((const char *)&frame, sizeof(frame));
+  if(!records.empty())
+    client.output.append((const char *)records.data(), records.size() * sizeof(T));
+}
+
+/* Sends as much of the output as the socket takes, false once the client is gone */
+bool flushServeClient(ServeClient &client)
+{
+  size_t sent = 0;
+  while(sent < client.output.size())
+  {
+    ssize_t bytes = send(client.fd, client.output.data() + sent, client.output.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if(bytes < 0 && errno == EINTR)
+      continue;
+    if(bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if(bytes <= 0)
+      return false;
+    sent += bytes;
+  }
+  client.output.erase(0, sent);
+  return true;
+}
+
+/* Reads whatever has arrived, false once the client hung up */
+bool fillServeClient(ServeClient &client)
+{
+  char buffer[SERVE_READ_BYTES];
+  for (;;)
+  {
+    ssize_t bytes = recv(client.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if(bytes < 0 && errno == EINTR)
+      continue;
+    if(bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return true;
+    if(bytes <= 0)
+      return false;
+    client.input.append(buffer, bytes);
+    if((size_t)bytes < sizeof(buffer))
+      return true;
+  }
+}
+
+void finishServeRequest(std::map<uint32_t, ServeRequest> &requests, uint32_t id, std::map<int, ServeClient> &clients, LatencyHistogram &latency)
+{
+  ServeRequest &request = requests[id];
+  std::map<int, ServeClient>::iterator client = clients.find(request.client);
+  if(client != clients.end())
+  {
+    queueServeFrame(client->second, SERVE_OUTCOMES, request.outcomes);
+    // A failed send shows up as a hang up in the poll loop
+    flushServeClient(client->second);
+    recordLatency(latency, chrono::duration<double, std::micro>(chrono::steady_clock::now() - request.received).count());
+  }
+  requests.erase(id);
+}
+
+/* --serve, a daemon on a Unix socket answering shot evaluations from warm workers. */
+/* The simulation lives in process globals, so the pool is forked processes: every level gets its own */
+/* workers, forked once the level is loaded, and concurrent requests on a level are batched onto them. */
+/* Clients are non-blocking and buffered both ways, only complete frames are acted on, so a slow or */
+/* stalled client holds up nobody else */
+int serveDaemon(const char *path, int numWorkers)
+{
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  if(poolLevels.empty())
+    poolLevels.push_back(levelPath ? levelPath : "");
+  if(poolLevels.size() > 65535)
+  {
+    printf("serve: at most 65535 levels\n");
+    return EXIT_FAILURE;
+  }
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(address.sun_path))
+  {
+    printf("serve: socket path `%s' is too long\n", path);
+    return EXIT_FAILURE;
+  }
+  strcpy(address.sun_path, path);
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path);
+  if(listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+  {
+    printf("serve: could not listen on `%s'\n", path);
+    return EXIT_FAILURE;
+  }
+  suppressReplay();
+
+  std::vector<int> inherited(1, listener);
+  std::vector<PoolWorker> workers;
+  int perLevel = max(1, numWorkers / (int)poolLevels.size());
+  for (size_t l = 0; l < poolLevels.size(); l++)
+  {
+    usePoolLevel(l);
+    for (int k = 0; k < perLevel; k++)
+    {
+      workers.push_back(PoolWorker());
+      workers.back().fd = -1;
+      workers.back().level = l;
+      if(!spawnPoolWorker(workers, workers.size() - 1, inherited))
+      {
+        printf("serve: could not start a worker for level %lu\n", (unsigned long)l);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  printf("serve: %s, %lu levels on %lu workers, ready in %.1f ms\n", path, (unsigned long)poolLevels.size(), (unsigned long)workers.size(), chrono::duration<double, std::milli>(chrono::steady_clock::now() - start).count());
+
+  std::map<int, ServeClient> clients;
+  std::map<uint32_t, ServeRequest> requests;
+  uint32_t nextRequest = 0;
+  std::vector<std::deque<PoolShot> > queues(poolLevels.size());
+  LatencyHistogram requestLatency, batchLatency;
+  memset(&requestLatency, 0, sizeof(requestLatency));
+  memset(&batchLatency, 0, sizeof(batchLatency));
+  unsigned long shotsServed = 0, restarts = 0;
+  std::vector<struct pollfd> fds;
+  std::vector<PoolShotResult> outcomes;
+  std::vector<ServeShot> shots;
+  std::vector<int> gone;
+  bool running = true;
+  while(running)
+  {
+    for (size_t w = 0; w < workers.size(); w++)
+      if(workers[w].shots.empty())
+        sendServeBatch(workers[w], queues);
+
+    fds.resize(1 + workers.size() + clients.size());
+    fds[0].fd = listener;
+    fds[0].events = POLLIN;
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+      fds[1 + w].fd = workers[w].shots.empty() ? -1 : workers[w].fd;
+      fds[1 + w].events = POLLIN;
+    }
+    size_t f = 1 + workers.size();
+    for (std::map<int, ServeClient>::iterator client = clients.begin(); client != clients.end(); ++client, f++)
+    {
+      // A client that does not read its replies is not read from either until it catches up
+      fds[f].fd = client->first;
+      fds[f].events = (client->second.closing || client->second.output.size() >= SERVE_OUTPUT_LIMIT ? 0 : POLLIN) | (client->second.output.empty() ? 0 : POLLOUT);
+    }
+    for (f = 0; f < fds.size(); f++)
+      fds[f].revents = 0;
+    if(poll(fds.data(), fds.size(), -1) < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      break;
+    }
+
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+      if(!fds[1 + w].revents)
+        continue;
+      PoolWorker &worker = workers[w];
+      uint32_t type;
+      if(receiveFrame(worker.fd, type, outcomes, POOL_BATCH) && type == POOL_OUTCOMES && outcomes.size() == worker.shots.size())
+      {
+        recordLatency(batchLatency, chrono::duration<double, std::micro>(chrono::steady_clock::now() - worker.sent).count());
+        for (size_t o = 0; o < outcomes.size(); o++)
+        {
+          std::map<uint32_t, ServeRequest>::iterator request = requests.find(outcomes[o].request);
+          if(request == requests.end() || outcomes[o].index >= request->second.outcomes.size())
+            continue;
+          request->second.outcomes[outcomes[o].index] = outcomes[o].outcome;
+          shotsServed++;
+          if(--request->second.remaining == 0)
+            finishServeRequest(requests, outcomes[o].request, clients, requestLatency);
+        }
+        worker.shots.clear();
+        continue;
+      }
+      // The worker crashed, its shots go back to the front of the queue for a fresh one
+      close(worker.fd);
+      kill(worker.pid, SIGKILL);
+      waitpid(worker.pid, NULL, 0);
+      worker.fd = -1;
+      for (size_t j = worker.shots.size(); j-- > 0; )
+      {
+        std::map<uint32_t, ServeRequest>::iterator request = requests.find(worker.shots[j].request);
+        if(request == requests.end())
+          continue;
+        if(++request->second.attempts[worker.shots[j].index] < POOL_MAX_ATTEMPTS)
+          queues[worker.level].push_front(worker.shots[j]);
+        else
+        {
+          ServeOutcome failed = {-1, -1};
+          request->second.outcomes[worker.shots[j].index] = failed;
+          if(--request->second.remaining == 0)
+            finishServeRequest(requests, worker.shots[j].request, clients, requestLatency);
+        }
+      }
+      worker.shots.clear();
+      restarts++;
+      inherited.resize(1);
+      for (std::map<int, ServeClient>::iterator client = clients.begin(); client != clients.end(); ++client)
+        inherited.push_back(client->first);
+      // Forked warm like the first workers, with its level loaded
+      usePoolLevel(worker.level);
+      if(!spawnPoolWorker(workers, w, inherited))
+      {
+        printf("serve: could not restart a worker\n");
+        running = false;
+      }
+    }
+
+    gone.clear();
+    for (f = 1 + workers.size(); f < fds.size() && running; f++)
+    {
+      if(!fds[f].revents)
+        continue;
+      ServeClient &client = clients[fds[f].fd];
+      bool keep = true;
+      if(fds[f].revents & POLLOUT)
+        keep = flushServeClient(client);
+      if(keep && (fds[f].revents & POLLIN))
+        keep = fillServeClient(client);
+      else if(fds[f].revents & (POLLERR | POLLHUP | POLLNVAL))
+        keep = false;
+      // Act on every complete frame, a partial one waits for the rest
+      size_t used = 0;
+      while(keep && !client.closing && running && client.input.size() - used >= sizeof(ServeFrame))
+      {
+        ServeFrame frame;
+        memcpy(&frame, client.input.data() + used, sizeof(frame));
+        bool valid = (frame.type == SERVE_EVALUATE && frame.count <= SERVE_MAX_SHOTS) || ((frame.type == SERVE_STATS || frame.type == SERVE_SHUTDOWN) && frame.count == 0);
+        if(!valid)
+        {
+          // Out of step, nothing after this frame can be trusted
+          queueServeFrame(client, SERVE_ERROR, std::vector<ServeOutcome>());
+          client.closing = true;
+          break;
+        }
+        size_t body = frame.type == SERVE_EVALUATE ? frame.count * sizeof(ServeShot) : 0;
+        if(client.input.size() - used < sizeof(frame) + body)
+          break;
+        shots.resize(body / sizeof(ServeShot));
+        if(body)
+          memcpy(shots.data(), client.input.data() + used + sizeof(frame), body);
+        used += sizeof(frame) + body;
+        if(frame.type == SERVE_SHUTDOWN)
+          running = false;
+        else if(frame.type == SERVE_STATS)
+        {
+          char line[160];
+          snprintf(line, sizeof(line), "serve_requests_pending %lu\nserve_shots_total %lu\nserve_worker_restarts_total %lu\nserve_clients %lu\n", (unsigned long)requests.size(), shotsServed, restarts, (unsigned long)clients.size());
+          std::string text = line;
+          exportLatency(text, "serve_request_latency_us", requestLatency);
+          exportLatency(text, "serve_batch_latency_us", batchLatency);
+          queueServeFrame(client, SERVE_STATS, std::vector<char>(text.begin(), text.end()));
+        }
+        else
+        {
+          bool levels = true;
+          for (size_t j = 0; j < shots.size() && levels; j++)
+            levels = shots[j].level < poolLevels.size();
+          if(!levels)
+          {
+            queueServeFrame(client, SERVE_ERROR, std::vector<ServeOutcome>());
+            continue;
+          }
+          uint32_t id = nextRequest++;
+          ServeRequest &request = requests[id];
+          request.client = client.fd;
+          request.remaining = shots.size();
+          request.outcomes.resize(shots.size());
+          request.attempts.assign(shots.size(), 0);
+          request.received = chrono::steady_clock::now();
+          for (size_t j = 0; j < shots.size(); j++)
+          {
+            PoolShot shot = {id, (uint32_t)j, shots[j]};
+            queues[shots[j].level].push_back(shot);
+          }
+          if(shots.empty())
+            finishServeRequest(requests, id, clients, requestLatency);
+        }
+      }
+      client.input.erase(0, used);
+      if(keep && !client.output.empty())
+        keep = flushServeClient(client);
+      if(!keep || (client.closing && client.output.empty()))
+        gone.push_back(client.fd);
+    }
+    for (size_t g = 0; g < gone.size(); g++)
+    {
+      // Its pending shots still run but nobody gets the answer
+      for (std::map<uint32_t, ServeRequest>::iterator request = requests.begin(); request != requests.end(); ++request)
+        if(request->second.client == gone[g])
+          request->second.client = -1;
+      close(gone[g]);
+      clients.erase(gone[g]);
+    }
+
+    if(fds[0].revents)
+    {
+      int fd = accept(listener, NULL, NULL);
+      if(fd >= 0 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0)
+      {
+        ServeClient &client = clients[fd];
+        client.fd = fd;
+        client.closing = false;
+      }
+      else if(fd >= 0)
+        close(fd);
+    }
+  }
+
+  std::vector<PoolShot> none;
+  for (size_t w = 0; w < workers.size(); w++)
+  {
+    sendFrame(workers[w].fd, POOL_QUIT, none);
+    close(workers[w].fd);
+    waitpid(workers[w].pid, NULL, 0);
+  }
+  for (std::map<int, ServeClient>::iterator client = clients.begin(); client != clients.end(); ++client)
+    close(client->first);
+  close(listener);
+  unlink(path);
+  printf("serve: %lu requests, %lu shots, %lu restarts, request latency p50 %.1f us, p99 %.1f us\n", (unsigned long)requestLatency.total, shotsServed, restarts, latencyQuantile(requestLatency, 0.5), latencyQuantile(requestLatency, 0.99));
+  return EXIT_SUCCESS;
+}
+
+/* Copy what the renderer needs into the back buffer and swap it with the shared one */
+void publishSnapshot()
+{
+  Snapshot &snap = snapshots[snapshotBack];
+  snap.tick = sim_tick;
+  snap.score = score;
+  snap.zoom = zoomLevel;
+  snap.canonAngle = canon_tunnel_angle;
+  snap.canonMomentum = canonMomentum;
+  snap.flyingBird = phy_start ? phy_index : -1;
+  snap.loadedBird = loadedBird();
+  snap.loadedBirdSize = snap.loadedBird < 0 ? 0 : birdSize[snap.loadedBird];
+  snap.worldKey = worldKey;
+  for (int i = 0; i < numOfBirds; i++)
+  {
+    float temp = (float)GROUND_HEIGHT + birdSize[i];
+    snap.birdVisible[i] = true;
+    snap.birdBomb[i] = 0;
+    if(birdStatus[i] == 0)
+      snap.birdX[i] = snap.birdY[i] = 0;
+    else if(birdStatus[i] == 1 && !phy_start)
+    {
+      snap.birdX[i] = 60.0f + (CANON_TUNNEL_LENGTH * cos(canon_tunnel_angle)) + birdDisplaceX[i];
+      snap.birdY[i] = 20.0f + (CANON_TUNNEL_LENGTH * sin(canon_tunnel_angle) + birdDisplaceY[i]);
+    }
+    else
+    {
+      snap.birdVisible[i] = birdStatus[i] == 1 || birdTime[i] < 5.0;
+      snap.birdX[i] = phy_x[i] - temp;
+      snap.birdY[i] = phy_y[i] - temp;
+    }
+    if(birdSpecial[i] && birdType[i] == 2 && birdStatus[i] < 2 && restore > 0)
+      snap.birdBomb[i] = birdSize[i];
+  }
+  snap.iceBroken.assign(iceBroken, iceBroken + numOfIce);
+  snap.iceTranslate.assign(iceTranslate, iceTranslate + numOfIce);
+  snap.piggyHurt.assign(piggyHurt, piggyHurt + numOfPiggy);
+  snap.piggyTranslate.assign(piggyTranslate, piggyTranslate + numOfPiggy);
+  snapshotBack = snapshotPresent.exchange(snapshotBack | SNAPSHOT_FRESH) & SNAPSHOT_INDEX;
+}
+
+/* Render thread side, takes the newest snapshot if there is one, never blocks */
+const Snapshot &acquireSnapshot()
+{
+  if(snapshotPresent.load() & SNAPSHOT_FRESH)
+    snapshotFront = snapshotPresent.exchange(snapshotFront) & SNAPSHOT_INDEX;
+  return snapshots[snapshotFront];
+}
+
+/* Fixed rate simulation, independent of how long rendering and swapping take */
+void simulationLoop()
+{
+  chrono::steady_clock::duration step = chrono::nanoseconds(1000000000 / SIM_TICK_RATE);
+  chrono::steady_clock::time_point next = chrono::steady_clock::now();
+  while(simRunning)
+  {
+    simulate();
+    publishSnapshot();
+    next += step;
+    // Resynchronise rather than spiral when the machine falls far behind
+    if(chrono::steady_clock::now() - next > SIM_MAX_LAG * step)
+      next = chrono::steady_clock::now();
+    this_thread::sleep_until(next);
+  }
+}
+
+void startSimulation()
+{
+  simRunning = true;
+  simThread = thread(simulationLoop);
+}
+
+void stopSimulation()
+{
+  if(!simRunning)
+    return;
+  simRunning = false;
+  simThread.join();
+}
+
+float camera_rotation_angle = 90;
+/* Render the scene with openGL */
+/* Edit this function according to your assignment */
+
+glm::mat4 rotateBird[10];
+glm::mat4 translateBird[10];
+
+/* Ortho bounds follow the camera, culling uses the same bounds */
+void updateProjection()
+{
+    Matrices.projection = glm::ortho(cameraX, cameraX + (float)(screen_width), 0.0f, (float)screen_height, 0.0f, 500.0f);
+    viewBounds = makeBounds(cameraX, 0.0f, cameraX + screen_width, screen_height);
+}
+
+/* Track the bird in flight, otherwise drift back to the canon */
+void updateCamera(const Snapshot &snap)
+{
+  float target = 0;
+  if(snap.flyingBird >= 0)
+  {
+    int i = snap.flyingBird;
+    target = (birdBounds[i].minX + birdBounds[i].maxX)/2 + snap.birdX[i] - screen_width * CAMERA_LEAD;
+  }
+  target = max(0.0f, min(target, worldWidth - screen_width));
+  cameraX += (target - cameraX) * CAMERA_EASE;
+  updateProjection();
+}
+
+/* One line strip buffer reused for every aim, only its first NumVertices points are drawn */
+void createTrajectoryPreview ()
+{
+  GLfloat colors[3 * TRAJECTORY_POINTS];
+  fill(colors, colors + 3 * TRAJECTORY_POINTS, 1.0f);
+  trajectoryPreview = create3DObject(GL_LINE_STRIP, TRAJECTORY_POINTS, trajectoryPoints, colors, GL_LINE);
+  glBindBuffer(GL_ARRAY_BUFFER, trajectoryPreview->VertexBuffer);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(trajectoryPoints), NULL, GL_DYNAMIC_DRAW);
+  trajectoryPreview->NumVertices = 0;
+}
+
+/* Render thread copy of the collision test, obstacle positions come from the snapshot */
+/* Only chunks around x can hold something within reach, their lists are the broad phase */
+bool previewContact(const Snapshot &snap, float x, float y, float birdRadius)
+{
+  int chunk = chunkOf(x);
+  for (int c = max(0, chunk - 1); c <= min(chunk + 1, (int)chunks.size() - 1); c++)
+  {
+    for (size_t k = 0; k < chunks[c].ice.size(); k++)
+    {
+      int i = chunks[c].ice[k];
+      float dx = x - iceX[i];
+      float dy = y - ((iceBounds[i].minY + iceBounds[i].maxY)/2 - snap.iceTranslate[i]);
+      float reach = iceBoundingCircle[i] + birdRadius;
+      if(snap.iceBroken[i] != 2 && dx*dx + dy*dy <= reach*reach)
+        return true;
+    }
+    for (size_t k = 0; k < chunks[c].piggy.size(); k++)
+    {
+      int i = chunks[c].piggy[k];
+      float dx = x - piggyX[i];
+      float dy = y - ((piggyBounds[i].minY + piggyBounds[i].maxY)/2 - 5.0f - snap.piggyTranslate[i]);
+      float reach = piggyRadius[i] + birdRadius;
+      if(snap.piggyHurt[i] != 2 && dx*dx + dy*dy <= reach*reach)
+        return true;
+    }
+  }
+  return false;
+}
+
+/* Predicted flight of the loaded bird, one point per simulation tick up to the first ground or obstacle contact */
+/* Rebuilt only when the aim, the power, the loaded bird or the obstacles (through the world key) change */
+void updateTrajectoryPreview(const Snapshot &snap)
+{
+  if(trajectoryPreview == NULL)
+    return;
+  if(snap.loadedBird == previewBird && snap.canonAngle == previewAngle && snap.canonMomentum == previewMomentum && snap.worldKey == previewWorld)
+    return;
+  previewWorld = snap.worldKey;
+  previewBird = snap.loadedBird;
+  previewAngle = snap.canonAngle;
+  previewMomentum = snap.canonMomentum;
+  int count = 0;
+  if(previewBird >= 0)
+  {
+    // Same closed form as solveShot, the bird centre leaves the muzzle
+    float temp = (float)GROUND_HEIGHT + snap.loadedBirdSize;
+    double c = simCos(previewAngle), sn = simSin(previewAngle);
+    double ux = previewMomentum * c, uy = previewMomentum * sn;
+    double x0 = 60.0f + CANON_TUNNEL_LENGTH * c + temp;
+    double y0 = 20.0f + CANON_TUNNEL_LENGTH * sn + temp;
+    for (; count < TRAJECTORY_POINTS; count++)
+    {
+      double t = count * physics.timeReference;
+      float x = x0 + ux * t;
+      float y = y0 + uy * t - (physics.gravity * t * t) / 2;
+      trajectoryPoints[3 * count] = x;
+      trajectoryPoints[3 * count + 1] = y;
+      trajectoryPoints[3 * count + 2] = 0;
+      if(count > 0 && (y - temp <= 0 || x > worldWidth || previewContact(snap, x, y, snap.loadedBirdSize)))
+      {
+        count++;
+        break;
+      }
+    }
+  }
+  trajectoryPreview->NumVertices = count;
+  if(count > 0)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, trajectoryPreview->VertexBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, 3 * count * sizeof(GLfloat), trajectoryPoints);
+  }
+}
+
+void draw (const Snapshot &snap)
+{
+  // Follow zoom and power changes made by the simulation
+  while(viewZoom < snap.zoom)
+  {
+    screen_height *= ZOOM_FRACTION;
+    screen_width *= ZOOM_FRACTION;
+    viewZoom++;
+    reshapeWindow(window, screen_height, screen_width);
+  }
+  while(viewZoom > snap.zoom)
+  {
+    screen_height /= ZOOM_FRACTION;
+    screen_width /= ZOOM_FRACTION;
+    viewZoom--;
+    reshapeWindow(window, screen_height, screen_width);
+  }
+  if(snap.canonMomentum != panelMomentum)
+    createPowerPanel(snap.canonMomentum);
+  snprintf(dispScore, sizeof(dispScore), "%d", snap.score);
+  updateCamera(snap);
+
+  // clear the color and depth in the frame buffer
+  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  // use the loaded shader program
+  // Don't change unless you know what you are doing
+  glUseProgram (programID);
+
+  // Eye - Location of camera. Don't change unless you are sure!!
+  glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
+  // Target - Where is the camera looking at.  Don't change unless you are sure!!
+  glm::vec3 target (0, 0, 0);
+  // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
+  glm::vec3 up (0, 1, 0);
+
+  // Compute Camera matrix (view)
+  // Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
+  //  Don't change unless you are sure!!
+  Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+
+  // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
+  //  Don't change unless you are sure!!
+  glm::mat4 VP = Matrices.projection * Matrices.view;
 
   // Send our transformation to the currently bound shader, in the "MVP" uniform
   // For each model you render, since the MVP will be different (at least the M part)
@@ -675,43 +3742,66 @@ void draw ()
   MVP = VP * Matrices.model;
   glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
 
-  draw3DObject(ground);
+  // Only chunks overlapping the view are submitted
+  int firstChunk = chunkOf(viewBounds.minX);
+  int lastChunk = chunkOf(viewBounds.maxX);
+  updateResidentChunks(firstChunk, lastChunk);
+  // Obstacles sit in the chunk of their left edge, one reaching in from the chunk before still shows
+  int firstObstacleChunk = chunkOf(viewBounds.minX - OBSTACLE_ICE_SIZE);
+  int lastObstacleChunk = min(lastChunk, (int)ceil(worldWidth / CHUNK_WIDTH) - 1);
+  glUseProgram(variants[VARIANT_CONSTANT_COLOR].programID);
+  glUniformMatrix4fv(variants[VARIANT_CONSTANT_COLOR].MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  glUniform3f(variants[VARIANT_CONSTANT_COLOR].colorID, 0.5, 0.18, 0.12);
+  for (int c = firstChunk; c <= lastChunk; c++)
+    draw3DObject(chunks[c].ground);
+  chunksDrawn += lastChunk - firstChunk + 1;
+  glUseProgram(programID);
   draw3DObject(PowerPanelOut);
   draw3DObject(PowerPanelFill);
 
-  for (int i = 0; i < numOfIce; i++)
+  // Every brick shares three unit meshes, visible ones are batched into one instanced draw each
+  int bricks = 0, breaks = 0;
+  for (int c = firstObstacleChunk; c <= lastObstacleChunk; c++)
+  for (size_t k = 0; k < chunks[c].ice.size(); k++)
   {
-    if(iceBroken[i]==0)
+    int i = chunks[c].ice[k];
+    if(snap.iceBroken[i] == 2 || !inView(iceBounds[i], 0, -1*snap.iceTranslate[i]))
+      continue;
+    float x = iceX[i];
+    float y = (iceBounds[i].minY + iceBounds[i].maxY)/2 - snap.iceTranslate[i];
+    float padding = 2.0f;
+    GLfloat *outline = &iceOutlineInstances[3 * bricks];
+    GLfloat *brick = &iceBrickInstances[3 * bricks];
+    outline[0] = brick[0] = x;
+    outline[1] = brick[1] = y;
+    outline[2] = iceBoundingCircle[i] + padding;
+    brick[2] = iceBoundingCircle[i];
+    bricks++;
+    if(snap.iceBroken[i] == 1)
     {
-      Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translateIce = glm::translate (glm::vec3(0, -1*iceTranslate[i], 0));        // glTranslatef
-      glm::mat4 rotateIce = glm::rotate(0.0f, glm::vec3(0, 0, 1));
-      Matrices.model *= translateIce* rotateIce; 
-      MVP = VP * Matrices.model;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      draw3DObject(iceBricksOutline[i]);
-      draw3DObject(iceBricks[i]);
-    }
-    else if(iceBroken[i] == 1)
-    {  
-      Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translateIce = glm::translate (glm::vec3(0, -1*iceTranslate[i], 0));        // glTranslatef
-      glm::mat4 rotateIce = glm::rotate(0.0f, glm::vec3(0, 0, 1));
-      Matrices.model *= translateIce* rotateIce; 
-      MVP = VP * Matrices.model;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      draw3DObject(iceBricksOutline[i]);
-      draw3DObject(iceBricks[i]);
-      draw3DObject(iceBreakLines[i]);      
+      GLfloat *breakLines = &iceBreakInstances[3 * breaks++];
+      breakLines[0] = x;
+      breakLines[1] = y;
+      breakLines[2] = (2*iceBoundingCircle[i])/3;
     }
   }
-
-  for (int i = 0; i < numOfPiggy; i++)
+  glUseProgram(variants[VARIANT_INSTANCED].programID);
+  glUniformMatrix4fv(variants[VARIANT_INSTANCED].MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  drawInstanced3DObject(iceOutlineMesh, &iceOutlineInstances[0], bricks);
+  drawInstanced3DObject(iceBrickMesh, &iceBrickInstances[0], bricks);
+  drawInstanced3DObject(iceBreakMesh, &iceBreakInstances[0], breaks);
+  glUseProgram(programID);
+
+  for (int c = firstObstacleChunk; c <= lastObstacleChunk; c++)
+  for (size_t k = 0; k < chunks[c].piggy.size(); k++)
   {
-    if(piggyHurt[i] == 0)
+    int i = chunks[c].piggy[k];
+    if(snap.piggyHurt[i] == 2 || !inView(piggyBounds[i], 0, -1*snap.piggyTranslate[i]))
+      continue;
+    if(snap.piggyHurt[i] == 0)
     {
       Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translatePiggy = glm::translate (glm::vec3(0, -1*piggyTranslate[i], 0));        // glTranslatef
+      glm::mat4 translatePiggy = glm::translate (glm::vec3(0, -1*snap.piggyTranslate[i], 0));        // glTranslatef
       glm::mat4 rotatePiggy = glm::rotate(0.0f, glm::vec3(0, 0, 1));
       Matrices.model *= translatePiggy* rotatePiggy; 
       MVP = VP * Matrices.model;
@@ -723,10 +3813,10 @@ void draw ()
       draw3DObject(piggyLeftEyeSclera[i]);
       draw3DObject(piggyRightEyeSclera[i]);
     }
-    else if(piggyHurt[i] == 1)
+    else if(snap.piggyHurt[i] == 1)
     {
       Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translatePiggy = glm::translate (glm::vec3(0, -1*piggyTranslate[i], 0));        // glTranslatef
+      glm::mat4 translatePiggy = glm::translate (glm::vec3(0, -1*snap.piggyTranslate[i], 0));        // glTranslatef
       glm::mat4 rotatePiggy = glm::rotate(0.0f, glm::vec3(0, 0, 1));
       Matrices.model *= translatePiggy* rotatePiggy; 
       MVP = VP * Matrices.model;
@@ -737,116 +3827,52 @@ void draw ()
       draw3DObject(piggyRightHurtEye[i]);
     }
   }
+  // Aim preview in world coordinates
+  updateTrajectoryPreview(snap);
+  if(trajectoryPreview != NULL && trajectoryPreview->NumVertices > 1)
+  {
+    glUseProgram(variants[VARIANT_CONSTANT_COLOR].programID);
+    glUniformMatrix4fv(variants[VARIANT_CONSTANT_COLOR].MatrixID, 1, GL_FALSE, &VP[0][0]);
+    glUniform3f(variants[VARIANT_CONSTANT_COLOR].colorID, 1, 1, 1);
+    draw3DObject(trajectoryPreview);
+    glUseProgram(programID);
+  }
+
     // Load identity to model matrix
   for (int i = 0; i < numOfBirds; i++)
   {
-    if(birdStatus[i] == 0)
-    {  
-      Matrices.model = glm::mat4(1.0f);
-      translateBird[i] = glm::translate (glm::vec3(0, 0, 0));        // glTranslatef
-      rotateBird[i] = glm::rotate(0.0f, glm::vec3(0,0,1));
-      Matrices.model *= translateBird[i] * rotateBird[i];
-      MVP = VP * Matrices.model;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      draw3DObject(birdBeak[i]);
-      draw3DObject(birdFace[i]);
-      draw3DObject(birdEyeIris[i]);
-      draw3DObject(birdEyeSclera[i]);
-      Matrices.model = glm::mat4(1.0f);
-    }
-    else if(birdStatus[i] == 1)
-    {
-      if((20.0f + ((CANON_TUNNEL_LENGTH * sin(phy_angle)) + birdDisplaceY[i])) <= 0)
-      {
-        birdDisplaceY[i] = -1*(20.0f + (CANON_TUNNEL_LENGTH * sin(phy_angle)));
-        if(phy_ux < VELOCITY_MIN)
-        {
-          phy_start = false;
-          birdStatus[i + 1] = 1;
-          birdStatus[i] = 2;
-        }
-        else
-        {
-          stamp(0.5, -GROUND_REBOUND);
-          physics_engine();
-        }
-      }
-      else
-      {
-        physics_engine();
-        phy_index = i;
-        Matrices.model = glm::mat4(1.0f);
-        if(!phy_start)
-        {
-          translateBird[i] = glm::translate (glm::vec3(60.0f + (CANON_TUNNEL_LENGTH * cos(canon_tunnel_angle)) + birdDisplaceX[i], 20.0f + (CANON_TUNNEL_LENGTH * sin(canon_tunnel_angle) + birdDisplaceY[i]), 0));        // glTranslatef
-          rotateBird[i] = glm::rotate(0.0f, glm::vec3(0,0,1));
-        }
-        else
-        {
-          float temp = (float)GROUND_HEIGHT + birdSize[i];
-          translateBird[i] = glm::translate (glm::vec3(phy_x[i] - temp, phy_y[i] - temp, 0));        // glTranslatef
-          rotateBird[i] = glm::rotate(0.0f, glm::vec3(0,0,1));
-        }
-        Matrices.model *= translateBird[i] * rotateBird[i];
-        MVP = VP * Matrices.model;
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        draw3DObject(birdBeak[i]);
-        draw3DObject(birdFace[i]);
-        draw3DObject(birdEyeIris[i]);
-        draw3DObject(birdEyeSclera[i]);
-        Matrices.model = glm::mat4(1.0f);
-      }
-    }
-    else
-    {
-      if(birdTime[i] < 5.0)
-      {
-        Matrices.model = glm::mat4(1.0f);
-        float temp = (float)GROUND_HEIGHT + birdSize[i];
-        translateBird[i] = glm::translate (glm::vec3(phy_x[i] - temp, phy_y[i] - temp, 0));        // glTranslatef
-        rotateBird[i] = glm::rotate(0.0f, glm::vec3(0,0,1));
-        Matrices.model *= translateBird[i] * rotateBird[i];
-        MVP = VP * Matrices.model;
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        draw3DObject(birdBeak[i]);
-        draw3DObject(birdFace[i]);
-        draw3DObject(birdEyeIris[i]);
-        draw3DObject(birdEyeSclera[i]);
-        birdSpecial[i] = false;
-        birdTime[i]+=0.05;
-      }
-    }
-    if(birdSpecial[i] && restore > 0)
-    {
-        if(birdType[i] == 2 && birdStatus[i] < 2)
-        {
-          float temp = (float)GROUND_HEIGHT + birdSize[i];
-          birdSize[i]*=1.2;
-          // GLfloat x, GLfloat y, GLfloat z, GLfloat radius, GLint numberOfSides, GLfloat red, GLfloat blue, GLfloat green)
-          birdBomb = drawCircle(temp, temp, 0.0f, birdSize[i], 360, 1, 1, 1);
-          draw3DObject(birdBomb);
-          restore -= 0.5;
-        }
-        else if(birdType[i] == 3)
-        {
-          stamp(2, 2);
-          restore = 0.0;
-        }
-    }
-    else
+    if(!snap.birdVisible[i])
+      continue;
+    // The special power bomb grows past the bird, never cull while it is shown
+    if(snap.birdBomb[i] == 0 && !inView(birdBounds[i], snap.birdX[i], snap.birdY[i]))
+      continue;
+    Matrices.model = glm::mat4(1.0f);
+    translateBird[i] = glm::translate (glm::vec3(snap.birdX[i], snap.birdY[i], 0));        // glTranslatef
+    rotateBird[i] = glm::rotate(0.0f, glm::vec3(0,0,1));
+    Matrices.model *= translateBird[i] * rotateBird[i];
+    MVP = VP * Matrices.model;
+    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+    draw3DObject(birdBeak[i]);
+    draw3DObject(birdFace[i]);
+    draw3DObject(birdEyeIris[i]);
+    draw3DObject(birdEyeSclera[i]);
+    if(snap.birdBomb[i] > 0)
     {
-      if(birdType[i]==2)
-        birdSize[i] = 15.0f;
+      // One quad cut into a circle by the fragment shader, nothing is rebuilt while it grows
+      float temp = (float)GROUND_HEIGHT + snap.birdBomb[i];
+      glUseProgram(variants[VARIANT_SDF_CIRCLE].programID);
+      glUniformMatrix4fv(variants[VARIANT_SDF_CIRCLE].MatrixID, 1, GL_FALSE, &MVP[0][0]);
+      glUniform3f(variants[VARIANT_SDF_CIRCLE].colorID, 1, 1, 1);
+      glUniform3f(variants[VARIANT_SDF_CIRCLE].circleID, temp, temp, snap.birdBomb[i]);
+      draw3DObject(unitQuad);
+      glUseProgram(programID);
     }
+    Matrices.model = glm::mat4(1.0f);
   }
 
-  checkFall();
-
-  if(canon_tunnel_angle + canon_tunnel_rotation >= 0 and canon_tunnel_angle + canon_tunnel_rotation < (M_PI/3))
-    canon_tunnel_angle += canon_tunnel_rotation;
   Matrices.model = glm::mat4(1.0f);
   glm::mat4 translateCanon = glm::translate (glm::vec3(CANON_WHEEL_CENTERX, CANON_WHEEL_CENTERY, 0));        // glTranslatef
-  glm::mat4 rotateCanon = glm::rotate(canon_tunnel_angle, glm::vec3(0, 0, 1));
+  glm::mat4 rotateCanon = glm::rotate(snap.canonAngle, glm::vec3(0, 0, 1));
   Matrices.model *= translateCanon * rotateCanon;
   translateCanon = glm::translate (glm::vec3(-1*CANON_WHEEL_CENTERX, -1*CANON_WHEEL_CENTERY, 0));        // glTranslatef
   rotateCanon = glm::rotate(0.0f, glm::vec3(0, 0, 1));
@@ -861,7 +3887,7 @@ void draw ()
   float fontScaleValue = 1.0;
 
   Matrices.model = glm::mat4(1.0f);
-  glm::mat4 translateText = glm::translate (glm::vec3(9*screen_width/10, 9*screen_height/10, 0));        // glTranslatef
+  glm::mat4 translateText = glm::translate (glm::vec3(cameraX + 9*screen_width/10, 9*screen_height/10, 0));        // glTranslatef
   Matrices.model *= translateText;
   MVP = VP * Matrices.model;
   glm::vec3 fontColor = glm::vec3(0, 0, 0);
@@ -869,31 +3895,36 @@ void draw ()
   glUseProgram(fontProgramID);
   glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
   glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
-  if(score < 50)
+  if(snap.score < WIN_SCORE)
   {
     GL3Font.font->Render("Score:");
+    drawCalls++;
     translateText = glm::translate (glm::vec3(90.0f, 0.0f, 0));        // glTranslatef
     Matrices.model *= translateText;
     MVP = VP * Matrices.model;
     glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
     GL3Font.font->Render(dispScore);
+    drawCalls++;
   }
   else
+  {
     GL3Font.font->Render("You Won!"); 
+    drawCalls++;
+  }
 
 }
 
-GLFWwindow* window; // window desciptor/handle
-
 /* Initialise glfw window, I/O callbacks and the renderer to use */
 /* Nothing to Edit here */
 GLFWwindow* initGLFW (int width, int height)
 {
 
+    chrono::steady_clock::time_point phaseStart = chrono::steady_clock::now();
     glfwSetErrorCallback(error_callback);
     if (!glfwInit()) {
         exit(EXIT_FAILURE);
     }
+    phaseStart = recordStartupPhase("glfwInit", phaseStart);
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -910,6 +3941,7 @@ GLFWwindow* initGLFW (int width, int height)
     glfwMakeContextCurrent(window);
     gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
     glfwSwapInterval( 1 );
+    recordStartupPhase("window and context", phaseStart);
 
     /* --- register callbacks with GLFW --- */
 
@@ -932,6 +3964,221 @@ GLFWwindow* initGLFW (int width, int height)
     return window;
 }
 
+void addBirds (LevelBuilder &builder)
+{
+  levelAddBird(builder, 10.0f, 1, 0, 0, 1);
+  levelAddBird(builder, 15.0f, 0.3, 0.3, 0.3, 2);
+  levelAddBird(builder, 12.0f, 1, 1, 0, 3);
+}
+
+/* Scripted input for benchmark scenes goes through the replay path */
+void benchInput(uint32_t tick, int code, int action)
+{
+  InputEvent event;
+  event.tick = tick;
+  event.code = (uint16_t)code;
+  event.action = (uint16_t)action;
+  replayLog.push_back(event);
+}
+
+/* Raise the canon for some ticks and launch the current bird */
+void benchShot(uint32_t tick, uint32_t aimTicks)
+{
+  benchInput(tick, INPUT_MOUSE_BASE + GLFW_MOUSE_BUTTON_LEFT, GLFW_PRESS);
+  benchInput(tick + aimTicks, INPUT_MOUSE_BASE + GLFW_MOUSE_BUTTON_LEFT, GLFW_RELEASE);
+  benchInput(tick + aimTicks + 1, GLFW_KEY_SPACE, GLFW_PRESS);
+}
+
+/* Zoom out until a square obstacle mesh fits on screen */
+void fitScreen(GLint sizeOfMesh)
+{
+  float needWidth = OBSTACLE_STARTSX + (sizeOfMesh + 1) * OBSTACLE_ICE_SIZE;
+  float needHeight = GROUND_HEIGHT + (sizeOfMesh + 1) * OBSTACLE_ICE_SIZE;
+  while(screen_width < needWidth || screen_height < needHeight)
+  {
+    screen_width /= ZOOM_FRACTION;
+    screen_height /= ZOOM_FRACTION;
+  }
+}
+
+/* Canned benchmark scenes, each one is a level plus a scripted input log */
+bool initBenchScene (const char *scene)
+{
+  replaying = true;
+  replayFooter.score = -1;
+  replayFooter.stateHash = 0;
+  LevelBuilder builder;
+  addBirds(builder);
+  if(!strcmp(scene, "idle"))
+  {
+    levelAddTower(builder, OBSTACLE_STARTSX, 3, 1);
+    useBenchLevel(builder);
+    replayFooter.ticks = 600;
+  }
+  else if(!strcmp(scene, "flight"))
+  {
+    levelAddTower(builder, OBSTACLE_STARTSX, 3, 1);
+    useBenchLevel(builder);
+    benchShot(0, 30);
+    replayFooter.ticks = 600;
+  }
+  else if(!strcmp(scene, "collapse"))
+  {
+    // Knock out the bottom row so the whole 10x10 tower falls through checkFall
+    fitScreen(10);
+    levelAddTower(builder, OBSTACLE_STARTSX, 10, 1);
+    useBenchLevel(builder);
+    for (int c = 0; c < numColumns; c++)
+    {
+      int cell = findCell(grid[columnTops[c]].col, 0);
+      if(cell < 0)
+        continue;
+      if(grid[cell].isPiggy)
+        piggyHurt[grid[cell].index] = 2;
+      else
+        iceBroken[grid[cell].index] = 2;
+      grid[cell].toReplace = true;
+    }
+    replayFooter.ticks = 600;
+  }
+  else if(!strcmp(scene, "stress"))
+  {
+    fitScreen(60);
+    levelAddTower(builder, OBSTACLE_STARTSX, 60, 20);
+    useBenchLevel(builder);
+    benchShot(0, 20);
+    replayFooter.ticks = 300;
+  }
+  else
+    return false;
+  createCanon();
+  buildChunks();
+  return true;
+}
+
+/* Create the level, also used on its own by headless replays */
+void initLevel ()
+{
+  if(benchScene)
+  {
+    if(!initBenchScene(benchScene))
+    {
+      cout << "Error: Unknown benchmark scene `" << benchScene << "'" << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  else
+  {
+    if(levelPath)
+      loadLevel();
+    else
+    {
+      LevelBuilder builder;
+      addBirds(builder);
+      levelAddTower(builder, OBSTACLE_STARTSX, 3, 1);
+      useLevel(builder);
+    }
+    createCanon();
+    buildChunks();
+  }
+  levelKey = computeLevelKey();
+  worldKey = computeWorldKey();
+  // Restarting goes back to exactly this state
+  saveWorld(levelStart);
+}
+
+double percentile(vector<double> &samples, double fraction)
+{
+  if(samples.empty())
+    return 0;
+  sort(samples.begin(), samples.end());
+  size_t index = (size_t)(fraction * (samples.size() - 1) + 0.5);
+  return samples[index];
+}
+
+/* Called once the first frame is on screen, prints where the time since launch went */
+void reportStartup()
+{
+  timeToFirstFrame = chrono::duration<double, milli>(chrono::steady_clock::now() - processStart).count();
+  for (size_t i = 0; i < startupPhases.size(); i++)
+    printf("Startup: %-36s %8.2f ms\n", startupPhases[i].name.c_str(), startupPhases[i].ms);
+  printf("Startup: %-36s %8.2f ms\n", "time to first frame", timeToFirstFrame);
+}
+
+/* Append one JSON object per scene, frame fields are null for headless runs */
+void writeBenchReport(double simSeconds, double wallSeconds, vector<double> &frameTimes)
+{
+  FILE *file = fopen(benchOut, "a");
+  if(!file)
+  {
+    cout << "Error: Could not write benchmark report `" << benchOut << "'" << endl;
+    return;
+  }
+  unsigned long frames = frameTimes.size();
+  fprintf(file, "{\"scene\": \"%s\", \"ticks\": %u, \"sim_ticks_per_sec\": %.1f", benchScene, sim_tick, simSeconds > 0 ? sim_tick / simSeconds : 0.0);
+  if(levelPath)
+    fprintf(file, ", \"level\": \"%s\"", levelPath);
+  else
+    fprintf(file, ", \"level\": null");
+  fprintf(file, ", \"ice\": %d, \"piggies\": %d", numOfIce, numOfPiggy);
+  if(timeToFirstFrame >= 0)
+    fprintf(file, ", \"time_to_first_frame_ms\": %.2f", timeToFirstFrame);
+  else
+    fprintf(file, ", \"time_to_first_frame_ms\": null");
+  fprintf(file, ", \"startup_ms\": {");
+  for (size_t i = 0; i < startupPhases.size(); i++)
+    fprintf(file, "%s\"%s\": %.2f", i ? ", " : "", startupPhases[i].name.c_str(), startupPhases[i].ms);
+  fprintf(file, "}");
+  if(headless)
+    fprintf(file, ", \"frames\": 0, \"frames_per_sec\": null, \"frame_ms_p50\": null, \"frame_ms_p99\": null, \"draw_calls_per_frame\": null, \"gl_buffer_bytes\": null, \"entities_drawn_per_frame\": null, \"entities_culled_per_frame\": null, \"chunks_drawn_per_frame\": null, \"gpu_memory_used_kb\": null, \"geometry_cache\": null");
+  else
+  {
+    fprintf(file, ", \"frames\": %lu, \"frames_per_sec\": %.1f", frames, wallSeconds > 0 ? frames / wallSeconds : 0.0);
+    fprintf(file, ", \"frame_ms_p50\": %.3f, \"frame_ms_p99\": %.3f", 1000 * percentile(frameTimes, 0.5), 1000 * percentile(frameTimes, 0.99));
+    fprintf(file, ", \"draw_calls_per_frame\": %.1f, \"gl_buffer_bytes\": %lu", frames ? (double)drawCalls / frames : 0.0, glBufferBytes);
+    fprintf(file, ", \"entities_drawn_per_frame\": %.1f, \"entities_culled_per_frame\": %.1f, \"chunks_drawn_per_frame\": %.1f", frames ? (double)entitiesDrawn / frames : 0.0, frames ? (double)entitiesCulled / frames : 0.0, frames ? (double)chunksDrawn / frames : 0.0);
+    // Only NVIDIA reports driver side memory use, everywhere else we rely on our own buffer tally
+    if(GLAD_GL_NVX_gpu_memory_info)
+    {
+      GLint total = 0, available = 0;
+      glGetIntegerv(GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX, &total);
+      glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available);
+      fprintf(file, ", \"gpu_memory_used_kb\": %d", total - available);
+    }
+    else
+      fprintf(file, ", \"gpu_memory_used_kb\": null");
+    fprintf(file, ", \"geometry_cache\": \"%s\"", geometryCacheHit ? "hit" : "miss");
+  }
+  fprintf(file, ", \"score\": %d}\n", score);
+  fclose(file);
+}
+
+/* Specialised builds of Sample_GL, each draw batch binds the leanest one it can use */
+void createShaderVariants ()
+{
+  const char *defines[VARIANT_COUNT] = {
+    "#define INSTANCED\n",
+    "#define CONSTANT_COLOR\n",
+    "#define SDF_CIRCLE\n#define CONSTANT_COLOR\n"
+  };
+  const char *phases[VARIANT_COUNT] = {"LoadShaders Sample_GL instanced", "LoadShaders Sample_GL constant color", "LoadShaders Sample_GL sdf circle"};
+  chrono::steady_clock::time_point phaseStart = chrono::steady_clock::now();
+  for (int v = 0; v < VARIANT_COUNT; v++)
+  {
+    variants[v].programID = LoadShaders("Sample_GL.vert", "Sample_GL.frag", defines[v]);
+    phaseStart = recordStartupPhase(phases[v], phaseStart);
+    variants[v].MatrixID = glGetUniformLocation(variants[v].programID, "MVP");
+    variants[v].colorID = glGetUniformLocation(variants[v].programID, "objectColor");
+    variants[v].circleID = glGetUniformLocation(variants[v].programID, "circle");
+  }
+
+  iceOutlineMesh = createInstanced3DObject(rectangleMesh(0, 0, 0, 1, 1, 0.65f, 0.94f, 0.95f, false));
+  iceBrickMesh = createInstanced3DObject(rectangleMesh(0, 0, 0, 1, 1, 0.65f, 0.94f, 0.95f, true));
+  iceBreakMesh = createInstanced3DObject(circleMesh(0, 0, 0, 1, 7, 0.0, 0.0, 1.0));
+  unitQuad = drawRectangle(0, 0, 0, 1, 1, 1, 1, 1, true);
+  recordStartupPhase("unit meshes", phaseStart);
+}
+
 /* Initialize the OpenGL rendering properties */
 /* Add all the models to be created here */
 /* Objects should be created before any other gl function and shaders */
@@ -944,21 +4191,21 @@ void initGL (GLFWwindow* window, int width, int height)
   glActiveTexture(GL_TEXTURE0);
 
   // Create and compile our GLSL program from the texture shaders
+  chrono::steady_clock::time_point phaseStart = chrono::steady_clock::now();
   textureProgramID = LoadShaders( "TextureRender.vert", "TextureRender.frag" );
+  phaseStart = recordStartupPhase("LoadShaders TextureRender", phaseStart);
   // Get a handle for our "MVP" uniform
   Matrices.TexMatrixID = glGetUniformLocation(textureProgramID, "MVP");
-	createBird(10.0f, 1, 0, 0, 0, 1);
-  createBird(15.0f, 0.3, 0.3, 0.3, 1, 2);
-  createBird(12.0f, 1, 1, 0, 2, 3);
-  createGround();
-  createCanon();
-  createObstacle(3, 1, OBSTACLE_STARTSX);
-  birdStatus[0] = 1;
+  initLevel();
+  phaseStart = recordStartupPhase("initLevel", phaseStart);
 
 	// Create and compile our GLSL program from the shaders
 	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
+	recordStartupPhase("LoadShaders Sample_GL", phaseStart);
 	// Get a handle for our "MVP" uniform
 	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+	createShaderVariants();
+	createTrajectoryPreview();
 
 
 	
@@ -972,10 +4219,14 @@ void initGL (GLFWwindow* window, int width, int height)
 	glDepthFunc (GL_LEQUAL);
 
     // Initialise FTGL stuff
-  const char* fontfile = "arial.ttf";
-  GL3Font.font = new FTExtrudeFont(fontfile); // 3D extrude style rendering
-
-  if(GL3Font.font->Error())
+  // FreeType reads the face straight from the embedded bytes
+  phaseStart = chrono::steady_clock::now();
+  const char* fontfile = FONT_FILE;
+  const EmbeddedAsset *fontAsset = findAsset(fontfile);
+  GL3Font.font = fontAsset ? new FTExtrudeFont(fontAsset->data, fontAsset->size) : NULL; // 3D extrude style rendering
+  phaseStart = recordStartupPhase("FTExtrudeFont", phaseStart);
+
+  if(!GL3Font.font || GL3Font.font->Error())
   {
     cout << "Error: Could not load font `" << fontfile << "'" << endl;
     glfwTerminate();
@@ -984,6 +4235,7 @@ void initGL (GLFWwindow* window, int width, int height)
 
   // Create and compile our GLSL program from the font shaders
   fontProgramID = LoadShaders( "fontrender.vert", "fontrender.frag" );
+  recordStartupPhase("LoadShaders fontrender", phaseStart);
   GLint fontVertexCoordAttrib, fontVertexNormalAttrib, fontVertexOffsetUniform;
   fontVertexCoordAttrib = glGetAttribLocation(fontProgramID, "vertexPosition");
   fontVertexNormalAttrib = glGetAttribLocation(fontProgramID, "vertexNormal");
@@ -992,7 +4244,9 @@ void initGL (GLFWwindow* window, int width, int height)
   GL3Font.fontColorID = glGetUniformLocation(fontProgramID, "fontColor");
 
   GL3Font.font->ShaderLocations(fontVertexCoordAttrib, fontVertexNormalAttrib, fontVertexOffsetUniform);
+  phaseStart = chrono::steady_clock::now();
   GL3Font.font->FaceSize(50);
+  recordStartupPhase("FaceSize", phaseStart);
   GL3Font.font->Depth(0);
   GL3Font.font->Outset(0, 0);
   GL3Font.font->CharMap(ft_encoding_unicode);
@@ -1006,25 +4260,203 @@ void initGL (GLFWwindow* window, int width, int height)
 
 int main (int argc, char** argv)
 {
+  const char *recordPath = NULL, *replayPath = NULL;
+  bool solve = false;
+  double mctsSeconds = 0;
+  const char *envName = NULL, *sweepPath = NULL, *estimatePath = NULL, *poolPath = NULL, *servePath = NULL;
+  int poolWorkers = max(1, (int)thread::hardware_concurrency());
+  int envInstances = max(1, (int)thread::hardware_concurrency());
+  for (int i = 1; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "--record") && i + 1 < argc)
+      recordPath = argv[++i];
+    else if(!strcmp(argv[i], "--replay") && i + 1 < argc)
+      replayPath = argv[++i];
+    else if(!strcmp(argv[i], "--headless"))
+      headless = true;
+    else if(!strcmp(argv[i], "--bench") && i + 1 < argc)
+      benchScene = argv[++i];
+    else if(!strcmp(argv[i], "--bench-out") && i + 1 < argc)
+      benchOut = argv[++i];
+    else if(!strcmp(argv[i], "--level") && i + 1 < argc)
+      levelPath = argv[++i];
+    else if(!strcmp(argv[i], "--solve"))
+      solve = true;
+    else if(!strcmp(argv[i], "--mcts") && i + 1 < argc)
+      mctsSeconds = atof(argv[++i]);
+    else if(!strcmp(argv[i], "--env") && i + 1 < argc)
+      envName = argv[++i];
+    else if(!strcmp(argv[i], "--instances") && i + 1 < argc)
+      envInstances = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--physics") && i + 1 < argc)
+    {
+      if(!parsePhysics(argv[++i], physics))
+      {
+        cout << "Error: --physics takes name=value pairs separated by commas, names are gravity, rebound, time, velocity-min and break-min" << endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if(!strcmp(argv[i], "--pool") && i + 1 < argc)
+      poolPath = argv[++i];
+    else if(!strcmp(argv[i], "--serve") && i + 1 < argc)
+      servePath = argv[++i];
+    else if(!strcmp(argv[i], "--workers") && i + 1 < argc)
+      poolWorkers = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--pool-levels") && i + 1 < argc)
+    {
+      std::string list = argv[++i];
+      for (size_t begin = 0, comma; begin <= list.size(); begin = comma + 1)
+      {
+        comma = min(list.find(',', begin), list.size());
+        poolLevels.push_back(list.substr(begin, comma - begin));
+      }
+    }
+    else if(!strcmp(argv[i], "--deterministic"))
+      deterministicPhysics = true;
+    else if(!strcmp(argv[i], "--sweep") && i + 1 < argc)
+      sweepPath = argv[++i];
+    else if(!strcmp(argv[i], "--estimate") && i + 1 < argc)
+      estimatePath = argv[++i];
+    else if(!strcmp(argv[i], "--samples") && i + 1 < argc)
+      estimateSamples = atol(argv[++i]);
+    else
+    {
+      cout << "Usage: " << argv[0] << " [--level file] [--physics name=value,...] [--deterministic] [--record file] [--replay file | --bench idle|flight|collapse|stress [--bench-out file] | --solve | --mcts seconds | --env name [--instances n] | --sweep file | --estimate file.ppm [--samples n] | --pool file | --serve socket] [--workers n] [--pool-levels a.abl,b.abl] [--headless]" << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  if(headless && !replayPath && !benchScene && !solve && mctsSeconds <= 0 && !envName && !sweepPath && !estimatePath && !poolPath && !servePath)
+  {
+    cout << "Error: --headless needs a session to --replay or a scene to --bench" << endl;
+    exit(EXIT_FAILURE);
+  }
+  if(replayPath && benchScene)
+  {
+    cout << "Error: --replay and --bench can not be combined" << endl;
+    exit(EXIT_FAILURE);
+  }
+  int tools = (solve ? 1 : 0) + (mctsSeconds > 0 ? 1 : 0) + (envName ? 1 : 0) + (sweepPath ? 1 : 0) + (estimatePath ? 1 : 0) + (poolPath ? 1 : 0) + (servePath ? 1 : 0);
+  if(tools > 1 || (tools && (replayPath || benchScene || recordPath)))
+  {
+    cout << "Error: --solve, --mcts, --env, --sweep, --estimate, --pool and --serve run on their own" << endl;
+    exit(EXIT_FAILURE);
+  }
+  if((poolPath || servePath) && poolWorkers < 1)
+  {
+    cout << "Error: --workers needs at least one worker" << endl;
+    exit(EXIT_FAILURE);
+  }
+  if(estimatePath && estimateSamples < 1)
+  {
+    cout << "Error: --samples needs at least one sample" << endl;
+    exit(EXIT_FAILURE);
+  }
+  if(envName && envInstances < 1)
+  {
+    cout << "Error: --instances needs at least one instance" << endl;
+    exit(EXIT_FAILURE);
+  }
+  // The solvers and the environment never open a window
+  if(tools)
+    headless = true;
+  if(replayPath && !loadReplay(replayPath))
+  {
+    cout << "Error: Could not read input log `" << replayPath << "'" << endl;
+    exit(EXIT_FAILURE);
+  }
+  if(deterministicPhysics && !floatContractionFree())
+    cout << "Warning: built with floating point contraction, deterministic mode needs -ffp-contract=off" << endl;
+  if(recordPath && !startRecording(recordPath))
+  {
+    cout << "Error: Could not create input log `" << recordPath << "'" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  // Headless replays only run the simulation, as fast as the machine allows
+  if(headless)
+  {
+    chrono::steady_clock::time_point phaseStart = chrono::steady_clock::now();
+    initLevel();
+    recordStartupPhase("initLevel", phaseStart);
+    if(solve)
+      exit(reportSolutions());
+    if(mctsSeconds > 0)
+      exit(reportMcts(mctsSeconds));
+    if(envName)
+      exit(serveEnvironment(envName, envInstances));
+    if(sweepPath)
+      exit(reportSweep(sweepPath));
+    if(estimatePath)
+      exit(reportEstimate(estimatePath));
+    if(poolPath)
+      exit(reportPool(poolPath, poolWorkers));
+    if(servePath)
+      exit(serveDaemon(servePath, poolWorkers));
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while(sim_tick < replayFooter.ticks)
+      simulate();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if(benchScene)
+    {
+      vector<double> noFrames;
+      writeBenchReport(seconds, seconds, noFrames);
+      exit(EXIT_SUCCESS);
+    }
+    exit(reportReplay(seconds));
+  }
 
   GLFWwindow* window = initGLFW(screen_width, screen_height);
 
 	initGL (window, screen_width, screen_height);
 
+  // Rendered replays are not tied to the display refresh either
+  if(replaying)
+    glfwSwapInterval(0);
+
+  // Benchmarks time complete frames, everything else starts drawing while the level streams in
+  if(benchScene)
+  {
+    chrono::steady_clock::time_point phaseStart = chrono::steady_clock::now();
+    finishGeometryBuild();
+    recordStartupPhase("finishGeometryBuild", phaseStart);
+  }
+
+  // Live play runs the simulation on its own thread, replays and benchmarks step it once per frame
+  publishSnapshot();
+  if(!replaying)
+    startSimulation();
+
   double last_update_time = glfwGetTime(), current_time;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  double simSeconds = 0;
+  vector<double> frameTimes;
 
     /* Draw in loop */
     while (!glfwWindowShouldClose(window)) {
+        chrono::steady_clock::time_point frameStart = chrono::steady_clock::now();
+
+        if(!simRunning)
+        {
+            simulate();
+            publishSnapshot();
+            simSeconds += chrono::duration<double>(chrono::steady_clock::now() - frameStart).count();
+        }
 
         // OpenGL Draw commands
-        draw();
-        snprintf(dispScore, sizeof(dispScore), "%d", score);
+        uploadStagedGeometry(GEOMETRY_UPLOAD_BUDGET);
+        draw(acquireSnapshot());
 
         // Swap Frame Buffer in double buffering
         glfwSwapBuffers(window);
+        if(timeToFirstFrame < 0)
+            reportStartup();
 
         // Poll for Keyboard and mouse events
         glfwPollEvents();
+        frameTimes.push_back(chrono::duration<double>(chrono::steady_clock::now() - frameStart).count());
+
+        if(replaying && sim_tick >= replayFooter.ticks)
+            break;
 
         // Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
         current_time = glfwGetTime(); // Time in seconds
@@ -1034,8 +4466,18 @@ int main (int argc, char** argv)
         }
     }
 
+    int status = EXIT_SUCCESS;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    stopSimulation();
+    stopGeometryBuild();
+    finishRecording();
+    if(benchScene)
+      writeBenchReport(simSeconds, seconds, frameTimes);
+    else if(replaying)
+      status = reportReplay(seconds);
+
     glfwTerminate();
-    exit(EXIT_SUCCESS);
+    exit(status);
 }
 
 
@@ -1066,39 +4508,13 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
                 quit(window);
                 break;
             case GLFW_KEY_SPACE:
-                if(!phy_start)
-                {
-                  phy_start = true;
-                  phy_angle = canon_tunnel_angle;
-                  phy_ux = canonMomentum * cos(canon_tunnel_angle);
-                  phy_uy = canonMomentum * sin(canon_tunnel_angle);
-                  for (int i = 0; i < numOfPiggy; ++i)
-                    colPiggy[i] = true;
-                  for (int i = 0; i < numOfIce; ++i)
-                    colIce[i] = true;
-                }
-                break;
             case GLFW_KEY_RIGHT:
-                createPowerPanel(5);
-                break;
             case GLFW_KEY_LEFT:
-                createPowerPanel(-5);
-                break;
             case GLFW_KEY_KP_ADD:
-                screen_height *= ZOOM_FRACTION;
-                screen_width *= ZOOM_FRACTION;
-                reshapeWindow(window, screen_height, screen_width);
-                createGround();
-                break;
             case GLFW_KEY_KP_SUBTRACT:
-                screen_height /= ZOOM_FRACTION;
-                screen_width /= ZOOM_FRACTION;
-                reshapeWindow(window, screen_height, screen_width);
-                createGround();
-                break;
             case GLFW_KEY_P:
-                birdSpecial[phy_index] = true;
-                restore = 5.00;
+            case GLFW_KEY_R:
+                queueInput(key, action);
                 break;
             default:
                 break;
@@ -1125,16 +4541,8 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
 {
     switch (button) {
         case GLFW_MOUSE_BUTTON_LEFT:
-            if (action == GLFW_RELEASE)
-                canon_tunnel_rotation = 0.0f;
-            else if(action == GLFW_PRESS)
-              canon_tunnel_rotation = 0.01f;
-            break;
         case GLFW_MOUSE_BUTTON_RIGHT:
-            if (action == GLFW_RELEASE)
-                canon_tunnel_rotation = 0.0f;
-            else
-              canon_tunnel_rotation = -0.01f;
+            queueInput(INPUT_MOUSE_BASE + button, action);
             break;
         default:
             break;
@@ -1165,5 +4573,5 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
     // Matrices.projection = glm::perspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
 
     // Ortho projection for 2D views
-    Matrices.projection = glm::ortho(0.0f, (float)(screen_width), 0.0f, (float)screen_height, 0.0f, 500.0f);
+    updateProjection();
 }
@@ -8,13 +8,53 @@
 #define CANON_TUNNEL_LENGTH 70
 #define OBSTACLE_STARTSX 800.0f
 #define OBSTACLE_ICE_SIZE 50.0f	
-#define EARTH_GRAVITY 10.0f
 #define CANON_MIN_MOM 80.0f
 #define CANON_MAX_MOM 120.0f
 #define POWER_PANEL_HALF_LENGTH 32.0f
 #define POWER_PANEL_HALF_WIDTH 5.0f
-#define GROUND_REBOUND 0.5f
-#define TIME_REFERENCE 0.1f
-#define VELOCITY_MIN 20.0f
-#define BREAK_MIN 30.0f
-#define ZOOM_FRACTION 0.8f
\ No newline at end of file
+#define ZOOM_FRACTION 0.8f
+#define INPUT_LOG_MAGIC "ABIR"
+// Version 2 hashes only the level's own ice and piggies, version 1 logs replay with their hash unchecked
+#define INPUT_LOG_VERSION 2
+#define INPUT_MOUSE_BASE 0x1000
+#define INPUT_END 0xFFFF
+#define INPUT_DETERMINISTIC 0xFFFE
+#define CANON_ROTATION 0.01f
+#define MOMENTUM_STEP 5
+#define SOLVER_VERIFY_TICKS 1200
+#define MCTS_ANGLE_STRIDE 3
+#define MCTS_EXPLORATION 0.7
+#define ENV_SPINS 10000
+#define ENV_BACKOFF_US 50
+// Backoffs between checks that the trainer and the game are still there
+#define ENV_LIVENESS_BACKOFFS 2000
+#define SWEEP_FACTOR_COUNT 5
+#define WIN_SCORE 50
+#define SHOT_CACHE_BYTES (64ul << 20)
+#define POOL_BATCH 64
+#define POOL_MAX_ATTEMPTS 3
+#define SERVE_HISTOGRAM_BUCKETS 80
+#define SERVE_BUCKETS_PER_OCTAVE 4
+#define SERVE_READ_BYTES 65536
+#define SERVE_OUTPUT_LIMIT (4 << 20)
+#define ESTIMATE_SAMPLES 20000
+#define ESTIMATE_CELL_PIXELS 16
+#define SIM_TICK_RATE 60
+#define SIM_MAX_LAG 5
+#define SNAPSHOT_INDEX 3
+#define SNAPSHOT_FRESH 4
+#define CHUNK_WIDTH 512.0f
+#define CHUNK_RESIDENT 1
+#define CAMERA_LEAD 0.3f
+#define CAMERA_EASE 0.1f
+#define TRAJECTORY_POINTS 256
+#define GEOMETRY_WORKERS_MAX 8
+#define GEOMETRY_BATCH 256
+#define GEOMETRY_UPLOAD_BUDGET 0.004
+#define GEOMETRY_CACHE_DIR ".geometrycache"
+#define GEOMETRY_CACHE_MAGIC "ABGC"
+#define GEOMETRY_CACHE_VERSION 1
+#define CIRCLE_SIDES 360
+#define SHADER_CACHE_DIR ".shadercache"
+#define PROGRAM_CACHE_MAGIC "ABPB"
+#define FONT_FILE "arial.ttf"
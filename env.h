@@ -0,0 +1,81 @@
+/* Shared memory layout of the vectorized environment, shared by the game and any trainer */
+/* One POSIX shared memory object holds this header, then the actions and observations of every */
+/* instance as structure of arrays, each array 8 byte aligned. The trainer writes actions, bumps */
+/* sequence with the command, and waits until finished equals numWorkers. A trainer stores its pid in */
+/* trainer once it has mapped the environment, workers give up when that process is gone. */
+
+#define ENV_MAGIC "ABEV"
+#define ENV_VERSION 2
+#define ENV_ALIGN 8
+
+enum { ENV_RESET = 1, ENV_STEP, ENV_CLOSE };
+
+typedef struct EnvHeader{
+  char magic[4];
+  uint32_t version;
+  uint32_t numInstances;
+  uint32_t numWorkers;
+  uint32_t numIce;
+  uint32_t numPiggy;
+  // Written by the trainer before sequence is bumped
+  uint32_t command;
+  // Only touched through envLoad, envStore and envAdd
+  uint32_t ready;
+  uint32_t sequence;
+  uint32_t finished;
+  // Pid of the trainer, 0 until one attaches
+  uint32_t trainer;
+  uint64_t size;
+  // Actions, one per instance: canon angle, momentum and ticks into the flight to use the special, -1 for never
+  uint64_t actionAngle, actionMomentum, actionSpecial;
+  // Observations: loaded bird (-1 once the episode is over), score, reward of the last step, done flag
+  uint64_t bird, score, reward, done;
+  // Per instance rows of numIce and numPiggy statuses: 0 intact, 1 hit, 2 destroyed
+  uint64_t iceStatus, piggyStatus;
+}EnvHeader;
+
+uint32_t envLoad(uint32_t *value)
+{
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+void envStore(uint32_t *value, uint32_t to)
+{
+  __atomic_store_n(value, to, __ATOMIC_RELEASE);
+}
+
+uint32_t envAdd(uint32_t *value, uint32_t by)
+{
+  return __atomic_add_fetch(value, by, __ATOMIC_ACQ_REL);
+}
+
+uint64_t envSection(uint64_t &offset, uint64_t bytes)
+{
+  uint64_t start = offset;
+  offset += (bytes + ENV_ALIGN - 1) & ~(uint64_t)(ENV_ALIGN - 1);
+  return start;
+}
+
+/* Fill in the array offsets from the counts, returns the total size */
+uint64_t envLayout(EnvHeader &header)
+{
+  uint64_t n = header.numInstances;
+  uint64_t offset = 0;
+  envSection(offset, sizeof(EnvHeader));
+  header.actionAngle = envSection(offset, n * sizeof(float));
+  header.actionMomentum = envSection(offset, n * sizeof(float));
+  header.actionSpecial = envSection(offset, n * sizeof(int32_t));
+  header.bird = envSection(offset, n * sizeof(int32_t));
+  header.score = envSection(offset, n * sizeof(int32_t));
+  header.reward = envSection(offset, n * sizeof(float));
+  header.done = envSection(offset, n * sizeof(uint8_t));
+  header.iceStatus = envSection(offset, n * header.numIce * sizeof(uint8_t));
+  header.piggyStatus = envSection(offset, n * header.numPiggy * sizeof(uint8_t));
+  header.size = offset;
+  return offset;
+}
+
+template <typename T> T *envArray(EnvHeader *header, uint64_t offset)
+{
+  return (T *)((char *)header + offset);
+}
@@ -2,6 +2,7 @@ struct VAO {
     GLuint VertexArrayID;
     GLuint VertexBuffer;
     GLuint ColorBuffer;
+    GLuint InstanceBuffer;
 
     GLenum PrimitiveMode;
     GLenum FillMode;
@@ -17,14 +18,12 @@ struct GLMatrices {
   GLuint TexMatrixID;
 } Matrices;
 
-typedef struct Obstacle{
-  int index;
-  int x;
-  int y;
-  int replacing;
-  bool isPiggy;
-  bool toReplace;
-}Obstacle;
+typedef struct Bounds{
+  float minX;
+  float minY;
+  float maxX;
+  float maxY;
+}Bounds;
 
 
 struct FTGLFont {
@@ -35,27 +34,61 @@ struct FTGLFont {
 
 GLuint programID, fontProgramID, textureProgramID;
 
-Obstacle all[10][10];
-VAO *ground;
-VAO *bird[10], *birdFace[10], *birdBeak[10], *birdEyeIris[10], *birdEyeSclera[10], *birdBomb;
+enum { VARIANT_INSTANCED, VARIANT_CONSTANT_COLOR, VARIANT_SDF_CIRCLE, VARIANT_COUNT };
+typedef struct ShaderVariant{
+  GLuint programID;
+  GLuint MatrixID;
+  GLint colorID;
+  GLint circleID;
+}ShaderVariant;
+ShaderVariant variants[VARIANT_COUNT];
+
+typedef struct Chunk{
+  VAO *ground;
+  std::vector<int> ice;
+  std::vector<int> piggy;
+}Chunk;
+
+/*Level related, the entity arrays and cells point into the level image*/
+const char *levelPath = NULL;
+std::vector<char> levelImage;
+Obstacle *grid = NULL;
+uint32_t *cellSlots = NULL;
+uint32_t slotCapacity = 0;
+int32_t *columnTops = NULL, *iceCell = NULL, *piggyCell = NULL;
+int numColumns = 0;
+VAO *bird[10], *birdFace[10], *birdBeak[10], *birdEyeIris[10], *birdEyeSclera[10];
 VAO *canonWheel, *canonTunnel, *PowerPanelFill, *PowerPanelOut;
-VAO *iceBricks[30], *iceBricksOutline[30], *iceBreakLines[30];
-VAO *piggyFace[30], *piggyLeftEyeIris[10], *piggyRightEyeIris[10], *piggyLeftEyeSclera[10], *piggyRightEyeSclera[10], *piggyNose[10];
-VAO *piggyLeftHurtEye[30], *piggyRightHurtEye[30];
+VAO *iceBrickMesh, *iceOutlineMesh, *iceBreakMesh, *unitQuad;
+std::vector<GLfloat> iceBrickInstances, iceOutlineInstances, iceBreakInstances;
+VAO *trajectoryPreview = NULL;
+GLfloat trajectoryPoints[3 * TRAJECTORY_POINTS];
+float previewAngle = -1, previewMomentum = -1;
+int previewBird = -2;
+uint64_t previewWorld = 0;
+std::vector<VAO*> piggyFace, piggyLeftEyeIris, piggyRightEyeIris, piggyLeftEyeSclera, piggyRightEyeSclera, piggyNose;
+std::vector<VAO*> piggyLeftHurtEye, piggyRightHurtEye;
+std::vector<Bounds> iceBounds, piggyBounds;
+Bounds birdBounds[10], viewBounds;
 float screen_height = SCREEN_HEIGHT;
 float screen_width = SCREEN_WIDTH;
+float worldWidth = SCREEN_WIDTH;
+float cameraX = 0;
+std::vector<Chunk> chunks;
+int residentFirst = 0, residentLast = -1;
 int numOfIce = 0, numOfPiggy = 0, numOfBirds = 0;
-int birdStatus[10] = {0}, birdType[10]; 
+// One slot past the last bird, landing hands the turn to birdStatus[i + 1] even for the last one
+int birdStatus[LEVEL_MAX_BIRDS + 1] = {0}, birdType[10]; 
 float birdDisplaceX[10] , birdDisplaceY[10], birdSize[10], birdTime[10] = {0};
-int iceBroken[30] = {0};
-float iceBoundingCircle[30], iceX[30], iceY[30], iceTranslate[10] = {0};
-int piggyHurt[10] = {0};
-float piggyRadius[10] = {0}, piggyX[10], piggyY[10], piggyTranslate[10] = {0};
+int *iceBroken = NULL;
+float *iceBoundingCircle = NULL, *iceX = NULL, *iceY = NULL, *iceTranslate = NULL;
+int *piggyHurt = NULL;
+float *piggyRadius = NULL, *piggyX = NULL, *piggyY = NULL, *piggyTranslate = NULL;
 float canonMomentum = 100.0f;
 float canon_tunnel_rotation = 0;
 float canon_tunnel_angle = 0;
-bool colPiggy[10] = {false};
-bool colIce[30] = {false};
+bool *colPiggy = NULL;
+bool *colIce = NULL;
 int score = 0;
 char dispScore[10];
 bool over = false;
@@ -67,6 +100,342 @@ float restore = 5.0;//For specia; functions
 
 
 /*Physics Engine related*/
+/* Tunables of the simulation, part of every world snapshot so each instance can carry its own set */
+/* timeReference is a double so the default steps phy_time exactly as the old literal 0.1 did */
+typedef struct PhysicsConfig{
+  float gravity;
+  float groundRebound;
+  double timeReference;
+  float velocityMin;
+  float breakMin;
+}PhysicsConfig;
+enum { PHYSICS_GRAVITY, PHYSICS_GROUND_REBOUND, PHYSICS_TIME_REFERENCE, PHYSICS_VELOCITY_MIN, PHYSICS_BREAK_MIN, PHYSICS_PARAMETER_COUNT };
+const char *physicsNames[PHYSICS_PARAMETER_COUNT] = {"gravity", "rebound", "time", "velocity-min", "break-min"};
+const PhysicsConfig defaultPhysics = {10.0f, 0.5f, 0.1, 20.0f, 30.0f};
+PhysicsConfig physics = defaultPhysics;
+// Own trig and explicit float math in the simulation, trajectories are then bit identical on every machine
+bool deterministicPhysics = false;
+
+/* Zobrist key of the obstacles: status, fall offset and cell occupancy, updated wherever they change */
+enum { ZOBRIST_ICE, ZOBRIST_PIGGY, ZOBRIST_ICE_FALL, ZOBRIST_PIGGY_FALL, ZOBRIST_CELL };
+uint64_t worldKey = 0;
+// Identity of the loaded level: counts, obstacle positions and birds, set by initLevel
+uint64_t levelKey = 0;
 float phy_ux, phy_uy, phy_vy, phy_time = 0.0f, phy_x[10], phy_y[10], phy_angle, bird_storeX[10] = {0}, bird_storeY[10] = {0};
 int phy_index;
-bool phy_start = false;
\ No newline at end of file
+bool phy_start = false;
+
+
+
+/*World snapshot related*/
+typedef struct WorldScalars{
+  int birdStatus[LEVEL_MAX_BIRDS + 1], birdType[10];
+  float birdDisplaceX[10], birdDisplaceY[10], birdSize[10], birdTime[10];
+  bool birdSpecial[10];
+  float restore;
+  int score;
+  bool over;
+  float canonMomentum, canon_tunnel_rotation, canon_tunnel_angle;
+  float phy_ux, phy_uy, phy_vy, phy_time, phy_x[10], phy_y[10], phy_angle, bird_storeX[10], bird_storeY[10];
+  int phy_index;
+  bool phy_start;
+  PhysicsConfig physics;
+  uint64_t worldKey;
+  // Written by saveWorld and checked by restoreWorld, never synced
+  uint64_t levelKey;
+}WorldScalars;
+
+char *levelState = NULL;
+size_t levelStateBytes = 0;
+std::vector<char> levelStart;
+
+
+
+/*Solver related*/
+typedef struct ShotSolution{
+  float angle;
+  int aimTicks;
+  float momentum;
+  int momentumSteps;
+  float flightTime;
+  bool confirmed;
+}ShotSolution;
+
+/* One bird's move for the tree search, indices into mctsAngles, mctsMomenta and mctsSpecialTicks */
+typedef struct MctsNode{
+  int parent;
+  int action;
+  std::vector<char> world;
+  std::vector<int> children;
+  std::vector<int> untried;
+  int visits;
+  double reward;
+  bool terminal;
+}MctsNode;
+
+/* What each search worker sends back: its best sequence, then visits and reward per first action */
+typedef struct MctsResult{
+  uint32_t iterations;
+  int32_t bestScore;
+  int32_t bestLength;
+  int32_t bestActions[10];
+}MctsResult;
+
+std::vector<float> mctsAngles, mctsMomenta;
+const int mctsSpecialTicks[] = {-1, 10, 20, 30, 45, 60};
+double mctsBudget = 0;
+EnvHeader *envShared = NULL;
+// Name of the shared memory object while --env serves it, for the signal handler
+const char *envPath = NULL;
+
+/* Outcomes of shots keyed by shotKey, a direct mapped table in shared memory that forked workers fill together */
+/* Each slot holds a ShotOutcome and the level state after the shot, guarded by a sequence number that is odd while it is written */
+typedef struct ShotCacheHeader{
+  uint64_t hits, misses, stores;
+  uint64_t slots, slotBytes;
+}ShotCacheHeader;
+typedef struct ShotCacheSlot{
+  uint32_t sequence;
+  int32_t ticks;
+  uint64_t key;
+}ShotCacheSlot;
+// Flight fields of one bird, the one fired and the one physics_engine still points at on the first tick
+typedef struct ShotFlight{
+  float birdDisplaceX, birdDisplaceY, phy_x, phy_y, bird_storeX, bird_storeY;
+}ShotFlight;
+// What a shot changes: the two birds above, per bird arrays that every tick touches (all in the key), and the scalars
+typedef struct ShotOutcome{
+  uint64_t levelKey;
+  int bird, prior;
+  ShotFlight flights[2];
+  int birdStatus[LEVEL_MAX_BIRDS + 1];
+  float birdSize[10], birdTime[10];
+  bool birdSpecial[10];
+  float restore;
+  int score;
+  bool over;
+  float canonMomentum, canon_tunnel_rotation, canon_tunnel_angle;
+  float phy_ux, phy_uy, phy_vy, phy_time, phy_angle;
+  int phy_index;
+  bool phy_start;
+  uint64_t worldKey;
+}ShotOutcome;
+ShotCacheHeader *shotCache = NULL;
+std::vector<char> shotCacheWorld;
+
+/* Worker pool wire format over the Unix sockets: a PoolFrame, then count records of the frame type */
+enum { POOL_JOBS = 1, POOL_RESULTS, POOL_SHOTS, POOL_OUTCOMES, POOL_QUIT };
+typedef struct PoolFrame{
+  uint32_t type;
+  uint32_t count;
+}PoolFrame;
+// One shot of the MCTS action grid fired from the start of a level
+typedef struct PoolJob{
+  uint32_t id;
+  uint16_t level;
+  uint16_t action;
+}PoolJob;
+typedef struct PoolResult{
+  uint32_t id;
+  int32_t score;
+  int32_t ticks;
+}PoolResult;
+// A shot of a --serve request, answered with the request and index it came with
+typedef struct PoolShot{
+  uint32_t request;
+  uint32_t index;
+  ServeShot shot;
+}PoolShot;
+typedef struct PoolShotResult{
+  uint32_t request;
+  uint32_t index;
+  ServeOutcome outcome;
+}PoolShotResult;
+typedef struct PoolWorker{
+  pid_t pid;
+  int fd;
+  std::vector<PoolJob> batch;
+  // --serve only: the level the worker was forked for, the shots it is working on and when they went out
+  int level;
+  std::vector<PoolShot> shots;
+  std::chrono::steady_clock::time_point sent;
+}PoolWorker;
+std::vector<std::string> poolLevels;
+
+/* Daemon related, histograms have SERVE_BUCKETS_PER_OCTAVE buckets for every doubling of the latency */
+typedef struct LatencyHistogram{
+  uint64_t counts[SERVE_HISTOGRAM_BUCKETS];
+  uint64_t total;
+  double sum, max;
+}LatencyHistogram;
+// Bytes read but not yet a whole frame, and replies the socket has not taken yet
+typedef struct ServeClient{
+  int fd;
+  std::string input, output;
+  // Sent a bad frame, dropped once its output is flushed
+  bool closing;
+}ServeClient;
+typedef struct ServeRequest{
+  int client;
+  uint32_t remaining;
+  std::vector<ServeOutcome> outcomes;
+  std::vector<uint8_t> attempts;
+  std::chrono::steady_clock::time_point received;
+}ServeRequest;
+int poolLevel = -1;
+
+/* Sweeps scale one parameter at a time by each factor, every combination fires the whole shot grid */
+const double sweepFactors[SWEEP_FACTOR_COUNT] = {0.5, 0.75, 1.0, 1.25, 1.5};
+typedef struct SweepResult{
+  int32_t job;
+  int32_t score;
+  int32_t ticks;
+}SweepResult;
+
+/* Sequences of the estimator, binned by the grid angle and momentum of their first shot */
+typedef struct EstimateCell{
+  uint32_t samples;
+  uint32_t wins;
+  double totalScore;
+  int32_t bestScore;
+}EstimateCell;
+long estimateSamples = ESTIMATE_SAMPLES;
+int estimateWorkers = 1;
+
+
+
+/*Input recording related*/
+typedef struct InputEvent{
+  uint32_t tick;
+  uint16_t code;
+  uint16_t action;
+}InputEvent;
+
+typedef struct InputLogFooter{
+  uint32_t ticks;
+  int32_t score;
+  uint32_t stateHash;
+}InputLogFooter;
+
+unsigned int sim_tick = 0;
+bool headless = false;
+std::vector<InputEvent> pendingInput;
+FILE *recordFile = NULL;
+std::vector<InputEvent> replayLog;
+size_t replayCursor = 0;
+bool replaying = false;
+InputLogFooter replayFooter;
+uint32_t replayVersion;
+
+
+
+/*Benchmark related*/
+const char *benchScene = NULL;
+const char *benchOut = "bench.json";
+unsigned long drawCalls = 0;
+unsigned long glBufferBytes = 0;
+unsigned long entitiesDrawn = 0, entitiesCulled = 0, chunksDrawn = 0;
+
+
+
+/*Threading related*/
+typedef struct Snapshot{
+  unsigned int tick;
+  int score;
+  int zoom;
+  float canonAngle;
+  float canonMomentum;
+  int flyingBird;
+  int loadedBird;
+  float loadedBirdSize;
+  // Changes whenever an obstacle breaks, falls or the world is restored
+  uint64_t worldKey;
+  bool birdVisible[10];
+  float birdX[10], birdY[10], birdBomb[10];
+  std::vector<int> iceBroken;
+  std::vector<float> iceTranslate;
+  std::vector<int> piggyHurt;
+  std::vector<float> piggyTranslate;
+}Snapshot;
+
+Snapshot snapshots[3];
+std::atomic<int> snapshotPresent(1);
+int snapshotBack = 0, snapshotFront = 2;
+std::mutex inputMutex;
+std::thread simThread;
+std::atomic<bool> simRunning(false);
+int zoomLevel = 0, viewZoom = 0;
+float panelMomentum = 0;
+
+
+
+/*Geometry build related*/
+typedef struct Mesh{
+  GLenum primitiveMode;
+  GLenum fillMode;
+  std::vector<GLfloat> vertices;
+  std::vector<GLfloat> colors;
+}Mesh;
+
+enum { MESH_BIRD_FACE, MESH_BIRD_BEAK, MESH_BIRD_EYE_IRIS, MESH_BIRD_EYE_SCLERA,
+       MESH_PIGGY_FACE, MESH_PIGGY_NOSE, MESH_PIGGY_LEFT_EYE_IRIS, MESH_PIGGY_RIGHT_EYE_IRIS,
+       MESH_PIGGY_LEFT_EYE_SCLERA, MESH_PIGGY_RIGHT_EYE_SCLERA, MESH_PIGGY_LEFT_HURT_EYE, MESH_PIGGY_RIGHT_HURT_EYE,
+       MESH_KIND_COUNT };
+
+/* Which VAO a mesh becomes, by kind and bird or piggy index, so it can also be stored in the cache file */
+typedef struct StagedMesh{
+  uint32_t kind;
+  uint32_t index;
+  Mesh mesh;
+}StagedMesh;
+
+std::vector<std::thread> geometryWorkers;
+std::atomic<int> geometryPending(0);
+std::atomic<bool> geometryAbort(false);
+std::vector<float> geometryPiggyY;
+std::mutex stagedMutex;
+std::vector<StagedMesh> stagedMeshes;
+std::vector<StagedMesh> uploadQueue;
+size_t uploadNext = 0;
+
+/* Cache file: this header, then per mesh a GeometryCacheMesh followed by its vertices and colors */
+typedef struct GeometryCacheHeader{
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint32_t numMeshes;
+  uint32_t reserved;
+}GeometryCacheHeader;
+
+typedef struct GeometryCacheMesh{
+  uint32_t kind;
+  uint32_t index;
+  uint32_t primitiveMode;
+  uint32_t fillMode;
+  uint32_t numVertices;
+}GeometryCacheMesh;
+
+uint64_t geometryKey = 0;
+std::vector<char> geometryCacheOut;
+uint32_t geometryCacheCount = 0;
+char *geometryCacheData = NULL;
+size_t geometryCacheSize = 0, geometryCacheNext = 0;
+bool geometryCacheHit = false;
+
+
+
+/*Startup related*/
+typedef struct StartupPhase{
+  std::string name;
+  double ms;
+}StartupPhase;
+
+std::chrono::steady_clock::time_point processStart = std::chrono::steady_clock::now();
+std::vector<StartupPhase> startupPhases;
+double timeToFirstFrame = -1;
+
+typedef struct EmbeddedAsset{
+  const char *name;
+  const unsigned char *data;
+  size_t size;
+}EmbeddedAsset;
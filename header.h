@@ -3,8 +3,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fstream>
+#include <iterator>
 #include <vector>
+#include <algorithm>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <deque>
+#include <map>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -0,0 +1,294 @@
+/* Binary level format, shared by the game and tools/levelc */
+/* The file is the initial state of every entity array: little-endian, */
+/* every section 8 byte aligned, so the game maps it and uses the arrays in place */
+
+#define LEVEL_MAGIC "ABLV"
+#define LEVEL_VERSION 2
+#define LEVEL_MAX_BIRDS 10
+#define LEVEL_ALIGN 8
+
+/* An occupied cell, only these are stored, col is the world x of its left edge */
+typedef struct Obstacle{
+  int index;
+  int col;
+  int row;
+  int replacing;
+  int below;
+  bool isPiggy;
+  bool toReplace;
+}Obstacle;
+
+typedef struct LevelBird{
+  float size;
+  float red;
+  float blue;
+  float green;
+  int32_t type;
+}LevelBird;
+
+typedef struct LevelHeader{
+  char magic[4];
+  uint32_t version;
+  uint32_t numBirds;
+  uint32_t numIce;
+  uint32_t numPiggy;
+  uint32_t numCells;
+  uint32_t numColumns;
+  uint32_t slotCapacity;
+  uint32_t reserved;
+  uint64_t size;
+  uint64_t birds;
+  uint64_t iceX, iceY, iceBoundingCircle, iceTranslate, iceBroken, colIce;
+  uint64_t piggyX, piggyY, piggyRadius, piggyTranslate, piggyHurt, colPiggy;
+  uint64_t cells, cellSlots, columnTops, iceCell, piggyCell;
+}LevelHeader;
+
+/* One obstacle cell while a level is being put together, in creation order */
+typedef struct LevelCell{
+  float left;
+  int row;
+  bool isPiggy;
+}LevelCell;
+
+typedef struct LevelBuilder{
+  std::vector<LevelBird> birds;
+  std::vector<LevelCell> cells;
+}LevelBuilder;
+
+static_assert(sizeof(bool) == 1 && sizeof(Obstacle) == 24, "level sections assume this layout");
+
+uint64_t levelSection(uint64_t &offset, uint64_t bytes)
+{
+  uint64_t start = offset;
+  offset += (bytes + LEVEL_ALIGN - 1) & ~(uint64_t)(LEVEL_ALIGN - 1);
+  return start;
+}
+
+/* Fill in the section offsets from the counts, returns the total size */
+uint64_t levelLayout(LevelHeader &header)
+{
+  uint64_t offset = 0;
+  levelSection(offset, sizeof(LevelHeader));
+  header.birds = levelSection(offset, header.numBirds * sizeof(LevelBird));
+  header.iceX = levelSection(offset, header.numIce * sizeof(float));
+  header.iceY = levelSection(offset, header.numIce * sizeof(float));
+  header.iceBoundingCircle = levelSection(offset, header.numIce * sizeof(float));
+  header.iceTranslate = levelSection(offset, header.numIce * sizeof(float));
+  header.iceBroken = levelSection(offset, header.numIce * sizeof(int));
+  header.colIce = levelSection(offset, header.numIce * sizeof(bool));
+  header.piggyX = levelSection(offset, header.numPiggy * sizeof(float));
+  header.piggyY = levelSection(offset, header.numPiggy * sizeof(float));
+  header.piggyRadius = levelSection(offset, header.numPiggy * sizeof(float));
+  header.piggyTranslate = levelSection(offset, header.numPiggy * sizeof(float));
+  header.piggyHurt = levelSection(offset, header.numPiggy * sizeof(int));
+  header.colPiggy = levelSection(offset, header.numPiggy * sizeof(bool));
+  header.cells = levelSection(offset, header.numCells * sizeof(Obstacle));
+  // Sections from iceX up to here are all the simulation writes, a world snapshot copies just this range
+  header.cellSlots = levelSection(offset, header.slotCapacity * sizeof(uint32_t));
+  header.columnTops = levelSection(offset, header.numColumns * sizeof(int32_t));
+  header.iceCell = levelSection(offset, header.numIce * sizeof(int32_t));
+  header.piggyCell = levelSection(offset, header.numPiggy * sizeof(int32_t));
+  header.size = offset;
+  return offset;
+}
+
+bool levelHostIsLittleEndian()
+{
+  uint16_t probe = 1;
+  return *(unsigned char *)&probe == 1;
+}
+
+/* Check a mapped level before any of its arrays are used */
+bool levelValidate(const char *data, uint64_t size, std::string &error)
+{
+  if(!levelHostIsLittleEndian())
+    error = "levels are little-endian only";
+  else if(size < sizeof(LevelHeader) || memcmp(data, LEVEL_MAGIC, 4) != 0)
+    error = "not a level file";
+  else
+  {
+    LevelHeader header = *(const LevelHeader *)data;
+    LevelHeader expected = header;
+    if(header.version != LEVEL_VERSION)
+      error = "unsupported level version";
+    else if(header.numBirds == 0 || header.numBirds > LEVEL_MAX_BIRDS || header.numCells != header.numIce + header.numPiggy || header.numColumns > header.numCells)
+      error = "bad level counts";
+    else if((header.slotCapacity & (header.slotCapacity - 1)) != 0 || header.slotCapacity < header.numCells)
+      error = "bad cell hash capacity";
+    else if(levelLayout(expected) != size || memcmp(&expected, &header, sizeof(header)) != 0)
+      error = "level sections do not match its counts";
+    else
+      return true;
+  }
+  return false;
+}
+
+/* Open addressed table from (col, row) to the cell there, slots hold cell + 1 and 0 when empty */
+uint32_t levelCellHash(int col, int row)
+{
+  uint64_t z = ((uint64_t)(uint32_t)col << 32) | (uint32_t)row;
+  z = (z ^ (z >> 33)) * 0xFF51AFD7ED558CCDull;
+  z = (z ^ (z >> 33)) * 0xC4CEB9FE1A85EC53ull;
+  return (uint32_t)(z ^ (z >> 33));
+}
+
+int levelFindCell(const Obstacle *cells, const uint32_t *slots, uint32_t capacity, int col, int row)
+{
+  if(capacity == 0)
+    return -1;
+  for (uint32_t slot = levelCellHash(col, row) & (capacity - 1); slots[slot] != 0; slot = (slot + 1) & (capacity - 1))
+  {
+    const Obstacle &cell = cells[slots[slot] - 1];
+    if(cell.col == col && cell.row == row)
+      return slots[slot] - 1;
+  }
+  return -1;
+}
+
+void levelAddBird(LevelBuilder &builder, float size, float red, float blue, float green, int type)
+{
+  LevelBird bird;
+  bird.size = size;
+  bird.red = red;
+  bird.blue = blue;
+  bird.green = green;
+  bird.type = type;
+  builder.birds.push_back(bird);
+}
+
+void levelAddCell(LevelBuilder &builder, float left, int row, bool isPiggy)
+{
+  LevelCell cell;
+  cell.left = left;
+  cell.row = row;
+  cell.isPiggy = isPiggy;
+  builder.cells.push_back(cell);
+}
+
+/* Square sizeOfMesh x sizeOfMesh shell of ice, depth thick, with piggies inside */
+void levelAddTower(LevelBuilder &builder, float startX, int sizeOfMesh, float depth)
+{
+  for (int i = 0; i < sizeOfMesh; i++)
+    for (int j = 0; j < sizeOfMesh; j++)
+      levelAddCell(builder, startX + i * OBSTACLE_ICE_SIZE, j, !(i < depth || i > sizeOfMesh - (depth + 1) || j < depth || j > sizeOfMesh - (depth + 1)));
+}
+
+bool levelCellBelow(const std::vector<Obstacle> &cells, int a, int b)
+{
+  return cells[a].col != cells[b].col ? cells[a].col < cells[b].col : cells[a].row < cells[b].row;
+}
+
+/* Lay out entity arrays and the occupied cells exactly as the game will use them */
+bool levelBuild(const LevelBuilder &builder, std::vector<char> &image, std::string &error)
+{
+  LevelHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, LEVEL_MAGIC, 4);
+  header.version = LEVEL_VERSION;
+  header.numBirds = builder.birds.size();
+  if(header.numBirds == 0 || header.numBirds > LEVEL_MAX_BIRDS)
+  {
+    error = "a level needs 1 to 10 birds";
+    return false;
+  }
+
+  // Cells keep creation order, that is the order ice and piggies are numbered in
+  std::vector<Obstacle> cells(builder.cells.size());
+  for (size_t c = 0; c < builder.cells.size(); c++)
+  {
+    const LevelCell &cell = builder.cells[c];
+    if(cell.row < 0)
+    {
+      error = "obstacle below the ground";
+      return false;
+    }
+    cells[c].index = cell.isPiggy ? header.numPiggy++ : header.numIce++;
+    cells[c].col = (int)floor(cell.left + 0.5f);
+    cells[c].row = cell.row;
+    cells[c].replacing = 0;
+    cells[c].below = -1;
+    cells[c].isPiggy = cell.isPiggy;
+    cells[c].toReplace = false;
+  }
+  header.numCells = cells.size();
+
+  // Walk every column bottom up to link cells to the one below them
+  std::vector<int> order(cells.size());
+  for (size_t c = 0; c < cells.size(); c++)
+    order[c] = c;
+  std::sort(order.begin(), order.end(), [&cells](int a, int b) { return levelCellBelow(cells, a, b); });
+  std::vector<int32_t> columnTops;
+  int height = 0;
+  for (size_t k = 0; k < order.size(); k++)
+  {
+    Obstacle &cell = cells[order[k]];
+    if(k > 0 && cells[order[k - 1]].col == cell.col)
+    {
+      if(cells[order[k - 1]].row == cell.row)
+      {
+        error = "two obstacles in the same cell";
+        return false;
+      }
+      cell.below = order[k - 1];
+      height++;
+    }
+    else
+    {
+      if(k > 0 && cell.col - cells[order[k - 1]].col < OBSTACLE_ICE_SIZE)
+      {
+        error = "structures overlap";
+        return false;
+      }
+      height = 0;
+    }
+    // Empty rows below start out vacated, whatever is stacked above them falls in
+    cell.replacing = cell.row - height;
+    if(k + 1 == order.size() || cells[order[k + 1]].col != cell.col)
+      columnTops.push_back(order[k]);
+  }
+  header.numColumns = columnTops.size();
+  header.slotCapacity = 0;
+  if(!cells.empty())
+    for (header.slotCapacity = 1; header.slotCapacity < 2 * cells.size(); header.slotCapacity *= 2);
+  levelLayout(header);
+
+  image.assign(header.size, 0);
+  char *base = &image[0];
+  memcpy(base, &header, sizeof(header));
+  memcpy(base + header.birds, &builder.birds[0], header.numBirds * sizeof(LevelBird));
+  if(!cells.empty())
+  {
+    memcpy(base + header.cells, &cells[0], cells.size() * sizeof(Obstacle));
+    memcpy(base + header.columnTops, &columnTops[0], columnTops.size() * sizeof(int32_t));
+  }
+
+  float half = OBSTACLE_ICE_SIZE/2;
+  uint32_t *slots = (uint32_t *)(base + header.cellSlots);
+  for (size_t c = 0; c < cells.size(); c++)
+  {
+    uint32_t slot = levelCellHash(cells[c].col, cells[c].row) & (header.slotCapacity - 1);
+    while(slots[slot] != 0)
+      slot = (slot + 1) & (header.slotCapacity - 1);
+    slots[slot] = c + 1;
+
+    float x = builder.cells[c].left + half;
+    float y = GROUND_HEIGHT + half + cells[c].row * OBSTACLE_ICE_SIZE;
+    int index = cells[c].index;
+    // Same padding createObstacle and createPiggy always used
+    if(cells[c].isPiggy)
+    {
+      ((int32_t *)(base + header.piggyCell))[index] = c;
+      ((float *)(base + header.piggyX))[index] = x;
+      ((float *)(base + header.piggyY))[index] = y - 5.0f;
+      ((float *)(base + header.piggyRadius))[index] = half - 5.0f;
+    }
+    else
+    {
+      ((int32_t *)(base + header.iceCell))[index] = c;
+      ((float *)(base + header.iceX))[index] = x;
+      ((float *)(base + header.iceY))[index] = y;
+      ((float *)(base + header.iceBoundingCircle))[index] = half - 2.0f;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,27 @@
+/* Wire format of sample2D --serve, shared by the daemon and its clients */
+/* A client connects to the daemon's Unix socket and sends a ServeFrame followed by count records: */
+/* SERVE_EVALUATE carries ServeShot records and is answered by SERVE_OUTCOMES with one ServeOutcome per shot, */
+/* SERVE_STATS carries nothing and is answered by SERVE_STATS with count bytes of text, SERVE_SHUTDOWN stops */
+/* the daemon. A request the daemon can not take is answered by SERVE_ERROR with no records. */
+
+#define SERVE_MAX_SHOTS 65536
+
+enum { SERVE_EVALUATE = 1, SERVE_OUTCOMES, SERVE_STATS, SERVE_SHUTDOWN, SERVE_ERROR };
+
+typedef struct ServeFrame{
+  uint32_t type;
+  uint32_t count;
+}ServeFrame;
+
+// Fired with the level's first bird from the start of the level, level indexes the daemon's --pool-levels
+typedef struct ServeShot{
+  uint16_t level;
+  int16_t special;
+  float angle;
+  float momentum;
+}ServeShot;
+
+typedef struct ServeOutcome{
+  int32_t score;
+  int32_t ticks;
+}ServeOutcome;
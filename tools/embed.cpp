@@ -0,0 +1,54 @@
+/* Turns shader and font files into a header of byte arrays, so sample2D needs nothing but itself */
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int main (int argc, char** argv)
+{
+  if(argc < 3)
+  {
+    cout << "Usage: " << argv[0] << " assets.h file..." << endl;
+    exit(EXIT_FAILURE);
+  }
+  string header = "/* Generated by tools/embed from the files listed below, do not edit */\n\n";
+  string table = "const EmbeddedAsset embeddedAssets[] = {\n";
+  for (int i = 2; i < argc; i++)
+  {
+    ifstream in(argv[i], ios::in | ios::binary);
+    if(!in.is_open())
+    {
+      cout << "Error: Could not read `" << argv[i] << "'" << endl;
+      exit(EXIT_FAILURE);
+    }
+    vector<unsigned char> bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    char line[128];
+    snprintf(line, sizeof(line), "// %s\nconst unsigned char asset%d[] = {", argv[i], i - 2);
+    header += line;
+    // A trailing zero keeps empty files legal C++ and lets text assets be used as C strings
+    bytes.push_back(0);
+    for (size_t b = 0; b < bytes.size(); b++)
+    {
+      snprintf(line, sizeof(line), "%s0x%02x,", b % 16 ? "" : "\n  ", bytes[b]);
+      header += line;
+    }
+    header += "\n};\n\n";
+    snprintf(line, sizeof(line), "  {\"%s\", asset%d, %lu},\n", argv[i], i - 2, (unsigned long)(bytes.size() - 1));
+    table += line;
+  }
+  header += table + "};\n";
+
+  FILE *out = fopen(argv[1], "wb");
+  if(!out || fwrite(header.data(), 1, header.size(), out) != header.size() || fclose(out) != 0)
+  {
+    cout << "Error: Could not write `" << argv[1] << "'" << endl;
+    exit(EXIT_FAILURE);
+  }
+  cout << argv[1] << ": " << argc - 2 << " assets" << endl;
+  return 0;
+}
@@ -0,0 +1,121 @@
+/* Minimal trainer for sample2D --env, plays random actions on every instance and reports throughput */
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../env.h"
+
+using namespace std;
+
+/* splitmix64, the same generator levelgen uses */
+uint64_t rngState = 1;
+
+uint64_t nextRandom()
+{
+  uint64_t z = (rngState += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+float randomUnit()
+{
+  return (nextRandom() >> 40) / (float)(1 << 24);
+}
+
+/* Hands a command to every worker and waits until all of them are done with it */
+void envCommand(EnvHeader *header, uint32_t command)
+{
+  envStore(&header->finished, 0);
+  header->command = command;
+  envAdd(&header->sequence, 1);
+  if(command == ENV_CLOSE)
+    return;
+  while(envLoad(&header->finished) != header->numWorkers)
+    this_thread::yield();
+}
+
+int main (int argc, char** argv)
+{
+  if(argc < 2)
+  {
+    cout << "Usage: " << argv[0] << " name [steps]" << endl;
+    exit(EXIT_FAILURE);
+  }
+  string path = argv[1][0] == '/' ? argv[1] : string("/") + argv[1];
+  int steps = argc > 2 ? atoi(argv[2]) : 1000;
+
+  // The game creates the object, wait for it to show up
+  int fd = -1;
+  for (int tries = 0; tries < 500 && (fd = shm_open(path.c_str(), O_RDWR, 0)) < 0; tries++)
+    usleep(10000);
+  struct stat info;
+  if(fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(EnvHeader))
+  {
+    cout << "Error: Could not open `" << path << "', is sample2D --env running?" << endl;
+    exit(EXIT_FAILURE);
+  }
+  EnvHeader *header = (EnvHeader *)mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(header == MAP_FAILED || memcmp(header->magic, ENV_MAGIC, 4) || header->version != ENV_VERSION || header->size != (uint64_t)info.st_size)
+  {
+    cout << "Error: `" << path << "' is not a version " << ENV_VERSION << " environment" << endl;
+    exit(EXIT_FAILURE);
+  }
+  envStore(&header->trainer, getpid());
+  while(envLoad(&header->ready) != header->numWorkers)
+    usleep(1000);
+
+  int n = header->numInstances;
+  float *angles = envArray<float>(header, header->actionAngle);
+  float *momenta = envArray<float>(header, header->actionMomentum);
+  int32_t *specials = envArray<int32_t>(header, header->actionSpecial);
+  const int32_t *scores = envArray<int32_t>(header, header->score);
+  const float *rewards = envArray<float>(header, header->reward);
+  const uint8_t *done = envArray<uint8_t>(header, header->done);
+
+  envCommand(header, ENV_RESET);
+  long shots = 0, episodes = 0;
+  double totalScore = 0, totalReward = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (int step = 0; step < steps; step++)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      angles[i] = randomUnit() * 1.0f;
+      momenta[i] = 40 + randomUnit() * 100;
+      specials[i] = randomUnit() < 0.5f ? -1 : (int)(randomUnit() * 60);
+    }
+    envCommand(header, ENV_STEP);
+    bool over = true;
+    for (int i = 0; i < n; i++)
+    {
+      totalReward += rewards[i];
+      over = over && done[i];
+    }
+    shots += n;
+    if(over)
+    {
+      for (int i = 0; i < n; i++)
+        totalScore += scores[i];
+      episodes += n;
+      envCommand(header, ENV_RESET);
+    }
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  envCommand(header, ENV_CLOSE);
+
+  printf("%d instances on %u workers: %ld shots in %.2f s, %.0f shots/s\n", n, header->numWorkers, shots, seconds, shots / seconds);
+  printf("mean reward per shot %.2f, mean episode score %.2f over %ld episodes\n", shots ? totalReward / shots : 0.0, episodes ? totalScore / episodes : 0.0, episodes);
+  munmap(header, info.st_size);
+  return 0;
+}
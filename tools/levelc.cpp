@@ -0,0 +1,121 @@
+/* Compiles a text level description into the binary level format the game maps */
+/*
+  # comment
+  bird <size> <red> <blue> <green> <type>
+  tower <startX> <sizeOfMesh> <depth>
+  structure <startX> <cols> <rows>
+  <rows lines of cols characters, top row first: I ice, P piggy, . empty>
+*/
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "../constant.h"
+#include "../level.h"
+
+using namespace std;
+
+bool parseLevel(istream &in, LevelBuilder &builder, string &error)
+{
+  string line;
+  int lineNumber = 0;
+  while(getline(in, line))
+  {
+    lineNumber++;
+    istringstream words(line);
+    string kind;
+    if(!(words >> kind) || kind[0] == '#')
+      continue;
+    bool ok = true;
+    if(kind == "bird")
+    {
+      float size, red, blue, green;
+      int type;
+      ok = (bool)(words >> size >> red >> blue >> green >> type);
+      if(ok)
+        levelAddBird(builder, size, red, blue, green, type);
+    }
+    else if(kind == "tower")
+    {
+      float startX, depth;
+      int sizeOfMesh;
+      ok = (bool)(words >> startX >> sizeOfMesh >> depth) && sizeOfMesh > 0;
+      if(ok)
+        levelAddTower(builder, startX, sizeOfMesh, depth);
+    }
+    else if(kind == "structure")
+    {
+      float startX;
+      int cols, rows;
+      ok = (bool)(words >> startX >> cols >> rows) && cols > 0 && rows > 0;
+      vector<string> picture(rows);
+      for (int j = rows - 1; ok && j >= 0; j--)
+      {
+        lineNumber++;
+        ok = getline(in, picture[j]) && (int)picture[j].size() >= cols;
+      }
+      // Same column by column order createObstacle always used
+      for (int i = 0; ok && i < cols; i++)
+      {
+        for (int j = 0; ok && j < rows; j++)
+        {
+          char c = picture[j][i];
+          if(c == 'I' || c == 'P')
+            levelAddCell(builder, startX + i * OBSTACLE_ICE_SIZE, j, c == 'P');
+          else
+            ok = c == '.';
+        }
+      }
+    }
+    else
+      ok = false;
+    if(!ok)
+    {
+      ostringstream message;
+      message << "line " << lineNumber << ": bad `" << kind << "'";
+      error = message.str();
+      return false;
+    }
+  }
+  return true;
+}
+
+int main (int argc, char** argv)
+{
+  if(argc != 3)
+  {
+    cout << "Usage: " << argv[0] << " level.txt level.abl" << endl;
+    exit(EXIT_FAILURE);
+  }
+  ifstream in(argv[1]);
+  if(!in.is_open())
+  {
+    cout << "Error: Could not read `" << argv[1] << "'" << endl;
+    exit(EXIT_FAILURE);
+  }
+  LevelBuilder builder;
+  vector<char> image;
+  string error;
+  if(!parseLevel(in, builder, error) || !levelBuild(builder, image, error))
+  {
+    cout << "Error: " << argv[1] << ": " << error << endl;
+    exit(EXIT_FAILURE);
+  }
+  FILE *out = fopen(argv[2], "wb");
+  if(!out || fwrite(&image[0], 1, image.size(), out) != image.size() || fclose(out) != 0)
+  {
+    cout << "Error: Could not write `" << argv[2] << "'" << endl;
+    exit(EXIT_FAILURE);
+  }
+  const LevelHeader *header = (const LevelHeader *)&image[0];
+  cout << argv[2] << ": " << header->numBirds << " birds, " << header->numIce << " ice, " << header->numPiggy << " piggies, " << image.size() << " bytes" << endl;
+  return 0;
+}
@@ -0,0 +1,134 @@
+/* Seeded generator for large binary levels, the same seed always gives the same level */
+#include <iostream>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "../constant.h"
+#include "../level.h"
+
+using namespace std;
+
+/* splitmix64, small and identical on every platform unlike rand() */
+uint64_t rngState;
+
+uint64_t nextRandom()
+{
+  uint64_t z = (rngState += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+int randomRange(int low, int high)
+{
+  return low + (int)(nextRandom() % (uint64_t)(high - low + 1));
+}
+
+bool randomChance(int percent)
+{
+  return randomRange(1, 100) <= percent;
+}
+
+/* Shell of ice around piggies, what createObstacle used to build */
+void addShell(LevelBuilder &builder, float startX, int size)
+{
+  levelAddTower(builder, startX, size, randomRange(1, max(1, size / 3)));
+}
+
+/* Columns of random height, piggies mixed into the ice */
+void addColumns(LevelBuilder &builder, float startX, int size)
+{
+  for (int i = 0; i < size; i++)
+  {
+    int height = randomRange(1, size);
+    for (int j = 0; j < height; j++)
+      levelAddCell(builder, startX + i * OBSTACLE_ICE_SIZE, j, randomChance(20));
+  }
+}
+
+/* Stepped pyramid with a piggy on top of every column */
+void addPyramid(LevelBuilder &builder, float startX, int size)
+{
+  for (int i = 0; i < size; i++)
+  {
+    int height = min(i, size - 1 - i) + 1;
+    for (int j = 0; j < height; j++)
+      levelAddCell(builder, startX + i * OBSTACLE_ICE_SIZE, j, j == height - 1);
+  }
+}
+
+int main (int argc, char** argv)
+{
+  uint64_t seed = 1;
+  long blocks = 10000;
+  int minSize = 3, maxSize = 30, maxGap = 6;
+  const char *outPath = NULL;
+  bool usage = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "--seed") && i + 1 < argc)
+      seed = strtoull(argv[++i], NULL, 10);
+    else if(!strcmp(argv[i], "--blocks") && i + 1 < argc)
+      blocks = atol(argv[++i]);
+    else if(!strcmp(argv[i], "--min-size") && i + 1 < argc)
+      minSize = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--max-size") && i + 1 < argc)
+      maxSize = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--max-gap") && i + 1 < argc)
+      maxGap = atoi(argv[++i]);
+    else if(!outPath && argv[i][0] != '-')
+      outPath = argv[i];
+    else
+      usage = true;
+  }
+  if(usage || !outPath || blocks <= 0 || minSize < 1 || maxSize < minSize || maxGap < 0)
+  {
+    cout << "Usage: " << argv[0] << " [--seed n] [--blocks n] [--min-size n] [--max-size n] [--max-gap n] level.abl" << endl;
+    exit(EXIT_FAILURE);
+  }
+  rngState = seed;
+
+  LevelBuilder builder;
+  levelAddBird(builder, 10.0f, 1, 0, 0, 1);
+  levelAddBird(builder, 15.0f, 0.3, 0.3, 0.3, 2);
+  levelAddBird(builder, 12.0f, 1, 1, 0, 3);
+
+  // Structures left to right until the block budget is used up
+  float startX = OBSTACLE_STARTSX;
+  int structures = 0;
+  while((long)builder.cells.size() < blocks)
+  {
+    int size = randomRange(minSize, maxSize);
+    switch(randomRange(0, 2))
+    {
+      case 0: addShell(builder, startX, size); break;
+      case 1: addColumns(builder, startX, size); break;
+      default: addPyramid(builder, startX, size); break;
+    }
+    startX += (size + randomRange(1, maxGap + 1)) * OBSTACLE_ICE_SIZE;
+    structures++;
+  }
+
+  vector<char> image;
+  string error;
+  if(!levelBuild(builder, image, error))
+  {
+    cout << "Error: " << error << endl;
+    exit(EXIT_FAILURE);
+  }
+  FILE *out = fopen(outPath, "wb");
+  if(!out || fwrite(&image[0], 1, image.size(), out) != image.size() || fclose(out) != 0)
+  {
+    cout << "Error: Could not write `" << outPath << "'" << endl;
+    exit(EXIT_FAILURE);
+  }
+  const LevelHeader *header = (const LevelHeader *)&image[0];
+  cout << outPath << ": seed " << seed << ", " << structures << " structures, " << header->numIce << " ice, " << header->numPiggy << " piggies, " << header->numColumns << " columns, " << image.size() << " bytes" << endl;
+  return 0;
+}
@@ -0,0 +1,147 @@
+/* Minimal client for sample2D --serve, sends random shots and reports round trip latency */
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../serve.h"
+
+using namespace std;
+
+/* splitmix64, the same generator levelgen uses */
+uint64_t rngState = 1;
+
+uint64_t nextRandom()
+{
+  uint64_t z = (rngState += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+float randomUnit()
+{
+  return (nextRandom() >> 40) / (float)(1 << 24);
+}
+
+bool sendAll(int fd, const void *data, size_t bytes)
+{
+  const char *from = (const char *)data;
+  while(bytes)
+  {
+    ssize_t sent = send(fd, from, bytes, MSG_NOSIGNAL);
+    if(sent <= 0)
+      return false;
+    from += sent;
+    bytes -= sent;
+  }
+  return true;
+}
+
+bool receiveAll(int fd, void *data, size_t bytes)
+{
+  char *to = (char *)data;
+  while(bytes)
+  {
+    ssize_t got = recv(fd, to, bytes, 0);
+    if(got <= 0)
+      return false;
+    to += got;
+    bytes -= got;
+  }
+  return true;
+}
+
+bool request(int fd, uint32_t type, const vector<ServeShot> &shots)
+{
+  ServeFrame frame = {type, (uint32_t)shots.size()};
+  return sendAll(fd, &frame, sizeof(frame)) && sendAll(fd, shots.data(), shots.size() * sizeof(ServeShot));
+}
+
+int main (int argc, char** argv)
+{
+  if(argc < 2)
+  {
+    cout << "Usage: " << argv[0] << " socket [requests [shots [levels]]] | socket --stats | socket --shutdown" << endl;
+    exit(EXIT_FAILURE);
+  }
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, argv[1], sizeof(address.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  // The daemon may still be starting, wait for the socket to show up
+  bool connected = false;
+  for (int tries = 0; tries < 500 && !(connected = connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0); tries++)
+    usleep(10000);
+  if(!connected)
+  {
+    cout << "Error: Could not connect to `" << argv[1] << "', is sample2D --serve running?" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  ServeFrame frame;
+  vector<ServeShot> none;
+  if(argc > 2 && !strcmp(argv[2], "--shutdown"))
+    return request(fd, SERVE_SHUTDOWN, none) ? 0 : EXIT_FAILURE;
+  if(argc > 2 && !strcmp(argv[2], "--stats"))
+  {
+    if(!request(fd, SERVE_STATS, none) || !receiveAll(fd, &frame, sizeof(frame)) || frame.type != SERVE_STATS)
+      exit(EXIT_FAILURE);
+    vector<char> text(frame.count);
+    if(!receiveAll(fd, text.data(), text.size()))
+      exit(EXIT_FAILURE);
+    fwrite(text.data(), 1, text.size(), stdout);
+    return 0;
+  }
+
+  int requests = argc > 2 ? atoi(argv[2]) : 1000;
+  int count = argc > 3 ? atoi(argv[3]) : 1;
+  int levels = argc > 4 ? atoi(argv[4]) : 1;
+  vector<ServeShot> shots(count);
+  vector<ServeOutcome> outcomes(count);
+  vector<double> latencies;
+  long scoring = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (int r = 0; r < requests; r++)
+  {
+    for (int i = 0; i < count; i++)
+    {
+      shots[i].level = nextRandom() % levels;
+      shots[i].angle = randomUnit() * 1.0f;
+      shots[i].momentum = 40 + randomUnit() * 100;
+      shots[i].special = randomUnit() < 0.5f ? -1 : (int)(randomUnit() * 60);
+    }
+    chrono::steady_clock::time_point sent = chrono::steady_clock::now();
+    if(!request(fd, SERVE_EVALUATE, shots) || !receiveAll(fd, &frame, sizeof(frame)))
+    {
+      cout << "Error: The daemon hung up" << endl;
+      exit(EXIT_FAILURE);
+    }
+    if(frame.type != SERVE_OUTCOMES || frame.count != (uint32_t)count)
+    {
+      cout << "Error: The daemon refused the request, are there " << levels << " levels?" << endl;
+      exit(EXIT_FAILURE);
+    }
+    if(!receiveAll(fd, outcomes.data(), outcomes.size() * sizeof(ServeOutcome)))
+      exit(EXIT_FAILURE);
+    latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - sent).count());
+    for (int i = 0; i < count; i++)
+      scoring += outcomes[i].score > 0;
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  close(fd);
+
+  sort(latencies.begin(), latencies.end());
+  printf("%d requests of %d shots in %.2f s, %.0f shots/s, %ld shots score\n", requests, count, seconds, requests * count / seconds, scoring);
+  if(!latencies.empty())
+    printf("round trip p50 %.1f us, p99 %.1f us, max %.1f us\n", latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], latencies.back());
+  return 0;
+}